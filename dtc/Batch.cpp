@@ -0,0 +1,159 @@
+#include "Batch.h"
+#include "Visit.h"
+
+Bytes write_batch(const std::vector<Bytes> &bodies, const Context &ctx) {
+    uint64_t total = 8 + ctx.size();
+    for (auto& body : bodies) {
+        total += 8 + body.size();
+    }
+    Bytes out = serialize_u64(bodies.size());
+    out.reserve(total);
+    for (auto& body : bodies) {
+        Bytes size = serialize_u64(body.size());
+        out.insert(out.end(), size.begin(), size.end());
+        out.insert(out.end(), body.begin(), body.end());
+    }
+    out.insert(out.end(), ctx.begin(), ctx.end());
+    return out;
+}
+
+BatchIndex read_batch_index(const Bytes &bytes) {
+    if (bytes.size() < 8) {
+        throw std::runtime_error("batch truncated");
+    }
+    uint64_t count = deserialize_u64(bytes.data());
+    if (count > (bytes.size() - 8) / 8) {
+        throw std::runtime_error("batch truncated");
+    }
+    BatchIndex index;
+    index.offsets.reserve(count);
+    index.sizes.reserve(count);
+    uint64_t pos = 8;
+    for (uint64_t i = 0; i < count; i++) {
+        if (bytes.size() - pos < 8) {
+            throw std::runtime_error("batch truncated");
+        }
+        uint64_t size = deserialize_u64(bytes.data() + pos);
+        pos += 8;
+        if (bytes.size() - pos < size) {
+            throw std::runtime_error("batch truncated");
+        }
+        index.offsets.push_back(pos);
+        index.sizes.push_back(size);
+        pos += size;
+    }
+    index.ctx_offset = pos;
+    return index;
+}
+
+void relocate_body(Bytes &body, uint64_t data_offset, const std::vector<uint64_t> &pointer_offsets, uint64_t base) {
+    for (uint64_t off : pointer_offsets) {
+        std::byte* slot = body.data() + data_offset + off;
+        uint64_t ptr = deserialize_u64(slot) + base;
+        for (size_t i = 0; i < sizeof(void*); i++) {
+            slot[i] = std::byte(ptr >> (i * 8));
+        }
+    }
+}
+
+void relocate_body(Bytes &body, const Plan &plan, uint64_t base) {
+    if (plan.flat) {
+        relocate_body(body, plan.header.size(), plan.pointers, base);
+        return;
+    }
+    // where a union's pointers are depends on its tag, so expand the value, shift its pointers
+    // and write it back
+    Bytes value(plan.size);
+    ByteStream stream(ByteSpan(body.data() + plan.header.size(), body.size() - plan.header.size()));
+    read_value(stream, plan.type, value.data());
+    for_each_pointer(plan.type, value.data(), [&](const Type&, std::byte* slot) {
+        uint64_t ptr = deserialize_u64(slot) + base;
+        for (size_t i = 0; i < sizeof(void*); i++) {
+            slot[i] = std::byte(ptr >> (i * 8));
+        }
+        return true;
+    });
+    body.resize(plan.header.size());
+    write_value(body, plan.type, value.data());
+}
+
+// a pointer slot's pointee, like the PlanOp that encodes it
+static PlanOp slot_op(const Type& t) {
+    PlanOp op;
+    if (t.deref_count > 0) {
+        Type pointee = t.deref();
+        auto b = std::get_if<BasicType>(&pointee.type);
+        op.kind = pointee.deref_count == 0 && b && b->bytes == 1 && !b->sign ? PlanOp::CString : PlanOp::Pointer;
+        op.size = t_sizeof(pointee);
+    } else {
+        auto& sl = std::get<SliceType>(t.type);
+        op.kind = PlanOp::Slice;
+        op.size = t_sizeof(sl.elem());
+        op.string = sl.string;
+    }
+    return op;
+}
+
+// the context offset in the slot, once its whole pointee is known to be inside ctx (strings up to
+// and including their terminator)
+static uint64_t checked_pointee(const std::byte* slot, const PlanOp& op, ByteSpan ctx) {
+    uint64_t ptr = deserialize_u64(slot);
+    if (ptr > ctx.size()) {
+        throw std::runtime_error("batch pointer outside the context");
+    }
+    uint64_t room = ctx.size() - ptr;
+    if (op.kind == PlanOp::CString) {
+        if (std::memchr(ctx.data() + ptr, 0, room) == nullptr) {
+            throw std::runtime_error("batch string has no terminator in the context");
+        }
+        return ptr;
+    }
+    uint64_t need = op.size;
+    if (op.kind == PlanOp::Slice) {
+        uint64_t count = deserialize_u64(slot + sizeof(void*));
+        if (op.size != 0 && count > room / op.size) {
+            throw std::runtime_error("batch slice is past the end of the context");
+        }
+        need = count * op.size + (op.string ? 1 : 0);
+    }
+    if (need > room) {
+        throw std::runtime_error("batch pointee is past the end of the context");
+    }
+    if (op.string && ctx[ptr + need - 1] != std::byte(0)) {
+        throw std::runtime_error("batch string has no terminator in the context");
+    }
+    return ptr;
+}
+
+void decode_body_into(const std::byte *body, uint64_t body_size, const Plan &plan, ByteSpan ctx_bytes,
+                      const Context &ctx, void *out) {
+    if (body_size < plan.header.size() || !std::equal(plan.header.begin(), plan.header.end(), body)) {
+        throw std::runtime_error("batch value has the wrong type");
+    }
+    auto* dst = static_cast<std::byte*>(out);
+    if (plan.flat) {
+        if (body_size - plan.header.size() != plan.size) {
+            throw std::runtime_error("batch value has the wrong type");
+        }
+        std::memcpy(dst, body + plan.header.size(), plan.size);
+        for (const PlanOp& op : plan.ops) {
+            if (op.kind == PlanOp::Copy) {
+                continue;
+            }
+            const std::byte* real = ctx.data() + checked_pointee(dst + op.offset, op, ctx_bytes);
+            std::memcpy(dst + op.offset, &real, sizeof(void*));
+        }
+        return;
+    }
+    // a union's body is as long as its active member, so it's read back rather than copied
+    ByteStream stream(ByteSpan(body + plan.header.size(), body_size - plan.header.size()));
+    read_value(stream, plan.type, dst);
+    if (stream.remaining() != 0) {
+        throw std::runtime_error("batch value has the wrong type");
+    }
+    for_each_pointer(plan.type, dst, [&](const Type& t, std::byte* slot) {
+        const std::byte* real = ctx.data() + checked_pointee(slot, slot_op(t), ctx_bytes);
+        std::memcpy(slot, &real, sizeof(void*));
+        return true;
+    });
+}
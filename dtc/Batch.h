@@ -0,0 +1,184 @@
+#pragma once
+#ifndef DTC_BATCH_H
+#define DTC_BATCH_H
+
+#include "Serial.h"
+#include "Parallel.h"
+#include "Plan.h"
+
+// Batch (many values of one type sharing one context):
+//  - count: u64
+//  - records: count times
+//     - body_size: u64
+//     - body: serialized variable (same as serialize())
+//  - context: all remaining bytes
+// the pointer slots of every body are offsets into the one shared context
+
+struct BatchIndex {
+    std::vector<uint64_t> offsets{}; // where each body starts
+    std::vector<uint64_t> sizes{};
+    uint64_t ctx_offset = 0;
+};
+
+Bytes write_batch(const std::vector<Bytes>& bodies, const Context& ctx);
+
+// throws if a size points past the end of the buffer
+BatchIndex read_batch_index(const Bytes& bytes);
+
+// checks that body holds a value of the plan's type, copies it to out (unions are read back, their
+// bodies are only as long as the active member) and turns each pointer slot into a real pointer
+// into ctx. every pointee is checked to be inside ctx_bytes, the context as it is in the batch
+// (the same size as ctx, which can still be being filled)
+void decode_body_into(const std::byte* body, uint64_t body_size, const Plan& plan, ByteSpan ctx_bytes,
+                      const Context& ctx, void* out);
+
+// adds base to each pointer slot of a serialized body, data_offset is the size of its type header
+void relocate_body(Bytes& body, uint64_t data_offset, const std::vector<uint64_t>& pointer_offsets, uint64_t base);
+
+// relocate_body for a body of the plan's type, unions included
+void relocate_body(Bytes& body, const Plan& plan, uint64_t base);
+
+// batches of fewer values than this (with less than a chunk of context, for decoding) are done on
+// the calling thread by the parallel functions, starting the threads would cost more than it saves
+const size_t BATCH_PARALLEL_MIN = 4096;
+
+// with intern_strings, each distinct string is stored once for the whole batch
+template<typename T>
+Bytes final_serialize_batch(const std::vector<T>& vals, const Type &t, bool intern_strings=false) {
+    const Plan& plan = plan_for(t);
+    if (sizeof(T) != plan.size) {
+        throw std::runtime_error("primitive type size mismatch");
+    }
+    Context ctx;
+    ctx.intern_strings = intern_strings;
+    std::vector<Bytes> bodies(vals.size());
+    for (size_t i = 0; i < vals.size(); i++) {
+        plan_encode(plan, &vals[i], ctx, bodies[i]);
+    }
+    return write_batch(bodies, ctx);
+}
+
+// same output as final_serialize_batch, byte for byte.
+// each worker serializes a contiguous slice into its own context, then the contexts are laid
+// out one after another (prefix sum of their sizes) and each slice's pointers are shifted by
+// where its context ended up.
+// with intern_strings, strings are only shared within a worker's slice, so the output is still
+// valid but can hold a few more copies than the serial one (and isn't byte for byte the same)
+template<typename T>
+Bytes final_serialize_batch_parallel(const std::vector<T>& vals, const Type &t, size_t threads=0,
+                                     bool intern_strings=false) {
+    size_t workers = vals.size() < BATCH_PARALLEL_MIN ? 1 : std::min(worker_count(threads), vals.size());
+    std::vector<Context> arenas(workers);
+    for (auto& arena : arenas) {
+        arena.intern_strings = intern_strings;
+    }
+    const Plan& plan = plan_for(t);
+    if (sizeof(T) != plan.size) {
+        throw std::runtime_error("primitive type size mismatch");
+    }
+    std::vector<std::pair<size_t, size_t>> ranges(workers);
+    std::vector<Bytes> bodies(vals.size());
+    parallel_for(vals.size(), workers, [&](size_t begin, size_t end, size_t w) {
+        ranges[w] = {begin, end};
+        for (size_t i = begin; i < end; i++) {
+            plan_encode(plan, &vals[i], arenas[w], bodies[i]);
+        }
+    });
+
+    std::vector<uint64_t> bases(workers);
+    uint64_t total = 0;
+    for (size_t w = 0; w < workers; w++) {
+        bases[w] = total;
+        total += arenas[w].size();
+    }
+
+    bool pointers = t_has_pointers(t);
+    Context ctx(total);
+    parallel_for(workers, workers, [&](size_t begin, size_t end, size_t) {
+        for (size_t w = begin; w < end; w++) {
+            std::copy(arenas[w].begin(), arenas[w].end(), ctx.begin() + std::ptrdiff_t(bases[w]));
+            if (bases[w] == 0 || !pointers) {
+                continue;
+            }
+            for (size_t i = ranges[w].first; i < ranges[w].second; i++) {
+                relocate_body(bodies[i], plan, bases[w]);
+            }
+        }
+    });
+    return write_batch(bodies, ctx);
+}
+
+template<typename T>
+struct DeserializedBatch {
+    std::vector<T> vals;
+    Context* ctx;
+};
+
+template<typename T>
+DeserializedBatch<T> final_deserialize_batch(const Bytes& bytes) {
+    BatchIndex index = read_batch_index(bytes);
+    // like final_deserialize, the values point into this context, so it outlives the call
+    auto* ctx = new Context(bytes.begin() + std::ptrdiff_t(index.ctx_offset), bytes.end());
+    DeserializedBatch<T> res{{}, ctx};
+    res.vals.reserve(index.offsets.size());
+    for (size_t i = 0; i < index.offsets.size(); i++) {
+        res.vals.push_back(deserialize<T>(*ctx, ByteSpan(bytes.data() + index.offsets[i], index.sizes[i])));
+    }
+    return res;
+}
+
+// decodes a batch of `count` values of type t into out, in order, with the values pointing into ctx
+// (which is replaced). records are decoded in chunks of chunk_size on a work-stealing pool,
+// the context is copied in chunks on the same pool.
+// this skips the Variable round trip: each body is checked against t, copied (read back, for a
+// type with unions) and relocated directly
+template<typename T>
+void final_deserialize_batch_parallel(const Bytes& bytes, const Type &t, T* out, size_t count, Context& ctx,
+                                      size_t threads=0, size_t chunk_size=1024) {
+    if (sizeof(T) != t_sizeof(t)) {
+        throw std::runtime_error("primitive type size mismatch");
+    }
+    BatchIndex index = read_batch_index(bytes);
+    if (index.offsets.size() != count) {
+        throw std::runtime_error("batch has a different number of values");
+    }
+    const Plan& plan = plan_for(t);
+    const uint64_t ctx_chunk = uint64_t(1) << 20;
+
+    ctx.resize(bytes.size() - index.ctx_offset);
+    if (count < BATCH_PARALLEL_MIN && ctx.size() <= ctx_chunk) {
+        threads = 1;
+    }
+    chunk_size = std::max<size_t>(chunk_size, 1);
+    size_t record_tasks = (count + chunk_size - 1) / chunk_size;
+    size_t ctx_tasks = (ctx.size() + ctx_chunk - 1) / ctx_chunk;
+    const std::byte* ctx_src = bytes.data() + index.ctx_offset;
+    ByteSpan ctx_bytes(ctx_src, ctx.size());
+    parallel_for_stealing(record_tasks + ctx_tasks, threads, [&](size_t task, size_t) {
+        if (task >= record_tasks) {
+            uint64_t begin = (task - record_tasks) * ctx_chunk;
+            uint64_t end = std::min<uint64_t>(begin + ctx_chunk, ctx.size());
+            std::copy(ctx_src + begin, ctx_src + end, ctx.data() + begin);
+            return;
+        }
+        size_t end = std::min(count, (task + 1) * chunk_size);
+        for (size_t i = task * chunk_size; i < end; i++) {
+            decode_body_into(bytes.data() + index.offsets[i], index.sizes[i], plan, ctx_bytes, ctx, out + i);
+        }
+    });
+}
+
+template<typename T>
+DeserializedBatch<T> final_deserialize_batch_parallel(const Bytes& bytes, const Type &t, size_t threads=0) {
+    BatchIndex index = read_batch_index(bytes);
+    DeserializedBatch<T> res{std::vector<T>(index.offsets.size()), new Context()};
+    try {
+        final_deserialize_batch_parallel(bytes, t, res.vals.data(), res.vals.size(), *res.ctx, threads);
+    } catch (...) {
+        delete res.ctx;
+        throw;
+    }
+    return res;
+}
+
+#endif //DTC_BATCH_H
@@ -0,0 +1,121 @@
+#include "Checksum.h"
+#include <cstring>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <nmmintrin.h>
+#define DTC_HAS_SSE42_PATH 1
+#endif
+
+namespace {
+
+const uint32_t CRC32C_POLY = 0x82F63B78; // reflected 0x1EDC6F41
+
+struct SliceTables {
+    uint32_t t[8][256];
+
+    SliceTables() {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) {
+                c = (c >> 1) ^ ((c & 1) ? CRC32C_POLY : 0);
+            }
+            t[0][i] = c;
+        }
+        for (uint32_t i = 0; i < 256; i++) {
+            for (int s = 1; s < 8; s++) {
+                t[s][i] = (t[s - 1][i] >> 8) ^ t[0][t[s - 1][i] & 0xFF];
+            }
+        }
+    }
+};
+
+const SliceTables& tables() {
+    static const SliceTables tbl;
+    return tbl;
+}
+
+uint64_t load_u64(const std::byte* p) {
+    uint64_t v;
+    std::memcpy(&v, p, 8);
+    return v; // the slice-by-8 and crc32q paths both expect little endian words
+}
+
+// both kernels work on the raw (inverted) crc state
+
+uint32_t crc_slice8(uint32_t c, std::byte* dst, const std::byte* src, size_t size) {
+    const SliceTables& tb = tables();
+    while (size >= 8) {
+        uint64_t w = load_u64(src);
+        if (dst) {
+            std::memcpy(dst, src, 8);
+            dst += 8;
+        }
+        w ^= c;
+        c = tb.t[7][w & 0xFF] ^ tb.t[6][(w >> 8) & 0xFF] ^
+            tb.t[5][(w >> 16) & 0xFF] ^ tb.t[4][(w >> 24) & 0xFF] ^
+            tb.t[3][(w >> 32) & 0xFF] ^ tb.t[2][(w >> 40) & 0xFF] ^
+            tb.t[1][(w >> 48) & 0xFF] ^ tb.t[0][w >> 56];
+        src += 8;
+        size -= 8;
+    }
+    while (size--) {
+        auto b = std::to_integer<uint8_t>(*src);
+        if (dst) {
+            *dst++ = *src;
+        }
+        c = (c >> 8) ^ tb.t[0][(c ^ b) & 0xFF];
+        src++;
+    }
+    return c;
+}
+
+#ifdef DTC_HAS_SSE42_PATH
+__attribute__((target("sse4.2")))
+uint32_t crc_sse42(uint32_t c, std::byte* dst, const std::byte* src, size_t size) {
+    uint64_t c64 = c;
+    while (size >= 8) {
+        uint64_t w = load_u64(src);
+        if (dst) {
+            std::memcpy(dst, &w, 8);
+            dst += 8;
+        }
+        c64 = _mm_crc32_u64(c64, w);
+        src += 8;
+        size -= 8;
+    }
+    c = static_cast<uint32_t>(c64);
+    while (size--) {
+        if (dst) {
+            *dst++ = *src;
+        }
+        c = _mm_crc32_u8(c, std::to_integer<uint8_t>(*src));
+        src++;
+    }
+    return c;
+}
+
+bool has_sse42() {
+    static const bool supported = __builtin_cpu_supports("sse4.2");
+    return supported;
+}
+#endif
+
+uint32_t crc_dispatch(uint32_t crc, std::byte* dst, const std::byte* src, size_t size) {
+    uint32_t c = ~crc;
+#ifdef DTC_HAS_SSE42_PATH
+    if (has_sse42()) {
+        return ~crc_sse42(c, dst, src, size);
+    }
+#endif
+    return ~crc_slice8(c, dst, src, size);
+}
+
+} // namespace
+
+uint32_t crc32c(uint32_t crc, const std::byte* data, size_t size) {
+    return crc_dispatch(crc, nullptr, data, size);
+}
+
+uint32_t crc32c_copy(uint32_t crc, std::byte* dst, const std::byte* src, size_t size) {
+    return crc_dispatch(crc, dst, src, size);
+}
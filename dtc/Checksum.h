@@ -0,0 +1,23 @@
+#pragma once
+#ifndef DTC_CHECKSUM_H
+#define DTC_CHECKSUM_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// CRC32C (Castagnoli), the same polynomial used by iSCSI/ext4/leveldb
+// uses the SSE4.2 crc32 instruction when the cpu has it, otherwise a slice-by-8 table
+// the crc argument is a previous result, so crc32c(crc32c(0, a), b) == crc32c(0, a + b)
+
+uint32_t crc32c(uint32_t crc, const std::byte* data, size_t size);
+
+// copies size bytes from src to dst and checksums them in the same pass,
+// so verifying a section while reading it out of a buffer doesn't scan it twice
+uint32_t crc32c_copy(uint32_t crc, std::byte* dst, const std::byte* src, size_t size);
+
+inline uint32_t crc32c(const std::vector<std::byte>& bytes) {
+    return crc32c(0, bytes.data(), bytes.size());
+}
+
+#endif //DTC_CHECKSUM_H
@@ -0,0 +1,176 @@
+#include "Container.h"
+#include <filesystem>
+
+uint64_t container_type_id(const Type &t) {
+    return t.fingerprint();
+}
+
+static void put_u64(Bytes& out, uint64_t v) {
+    for (int i = 0; i < 8; i++) {
+        out.push_back(std::byte(v >> (i * 8)));
+    }
+}
+
+static Bytes serialize_index(const std::vector<ContainerEntry>& entries, uint64_t index_offset) {
+    Bytes out;
+    out.reserve(entries.size() * CONTAINER_ENTRY_SIZE + CONTAINER_FOOTER_SIZE);
+    for (auto& e : entries) {
+        put_u64(out, e.offset);
+        put_u64(out, e.size);
+        put_u64(out, e.type_id);
+        out.push_back(std::byte(e.has_keys ? 1 : 0));
+        put_u64(out, uint64_t(e.min_key));
+        put_u64(out, uint64_t(e.max_key));
+    }
+    put_u64(out, index_offset);
+    put_u64(out, entries.size());
+    put_u64(out, CONTAINER_MAGIC);
+    return out;
+}
+
+std::vector<ContainerEntry> read_container_index(std::istream &file, uint64_t &index_offset) {
+    file.seekg(0, std::ios::end);
+    auto file_size = uint64_t(file.tellg());
+    if (file_size < CONTAINER_FOOTER_SIZE) {
+        throw std::runtime_error("container footer missing");
+    }
+    Bytes footer(CONTAINER_FOOTER_SIZE);
+    file.seekg(std::streamoff(file_size - CONTAINER_FOOTER_SIZE));
+    file.read(reinterpret_cast<char*>(footer.data()), std::streamsize(footer.size()));
+    if (!file || deserialize_u64(footer.data() + 16) != CONTAINER_MAGIC) {
+        throw std::runtime_error("not a container file");
+    }
+    index_offset = deserialize_u64(footer.data());
+    uint64_t count = deserialize_u64(footer.data() + 8);
+    if (index_offset > file_size - CONTAINER_FOOTER_SIZE ||
+        count != (file_size - CONTAINER_FOOTER_SIZE - index_offset) / CONTAINER_ENTRY_SIZE) {
+        throw std::runtime_error("container index corrupt");
+    }
+
+    Bytes raw(count * CONTAINER_ENTRY_SIZE);
+    file.seekg(std::streamoff(index_offset));
+    file.read(reinterpret_cast<char*>(raw.data()), std::streamsize(raw.size()));
+    if (!file) {
+        throw std::runtime_error("container index truncated");
+    }
+    std::vector<ContainerEntry> entries(count);
+    for (size_t i = 0; i < count; i++) {
+        const std::byte* p = raw.data() + i * CONTAINER_ENTRY_SIZE;
+        ContainerEntry& e = entries[i];
+        e.offset = deserialize_u64(p);
+        e.size = deserialize_u64(p + 8);
+        e.type_id = deserialize_u64(p + 16);
+        e.has_keys = p[24] != std::byte(0);
+        e.min_key = int64_t(deserialize_u64(p + 25));
+        e.max_key = int64_t(deserialize_u64(p + 33));
+        if (e.offset > index_offset || e.size > index_offset - e.offset) {
+            throw std::runtime_error("container index corrupt");
+        }
+    }
+    return entries;
+}
+
+ContainerWriter::ContainerWriter(const std::string &path) {
+    std::error_code ec;
+    if (std::filesystem::exists(path, ec) && std::filesystem::file_size(path, ec) > 0) {
+        file.open(path, std::ios::in | std::ios::out | std::ios::binary);
+        if (!file) {
+            throw std::runtime_error("could not open container " + path);
+        }
+        entries = read_container_index(file, end);
+        file.clear();
+    } else {
+        file.open(path, std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!file) {
+            throw std::runtime_error("could not create container " + path);
+        }
+        end = 0;
+    }
+    open = true;
+}
+
+ContainerWriter::~ContainerWriter() {
+    if (open) {
+        try {
+            close();
+        } catch (const std::exception&) {
+            // destructors can't throw, call close() directly to see the error
+        }
+    }
+}
+
+size_t ContainerWriter::append_frame(const Bytes &frame, uint64_t type_id) {
+    if (!open) {
+        throw std::runtime_error("container writer is closed");
+    }
+    FrameHeader h = read_frame_header(frame);
+    if (!(h.flags & FRAME_SIZED) || h.frame_size() != frame.size()) {
+        throw std::runtime_error("container records must be sized frames");
+    }
+    file.seekp(std::streamoff(end));
+    file.write(reinterpret_cast<const char*>(frame.data()), std::streamsize(frame.size()));
+    if (!file) {
+        throw std::runtime_error("container write failed");
+    }
+    ContainerEntry e;
+    e.offset = end;
+    e.size = frame.size();
+    e.type_id = type_id;
+    entries.push_back(e);
+    end += frame.size();
+    return entries.size() - 1;
+}
+
+size_t ContainerWriter::append_frame(const Bytes &frame, uint64_t type_id, int64_t min_key, int64_t max_key) {
+    size_t i = append_frame(frame, type_id);
+    entries[i].has_keys = true;
+    entries[i].min_key = min_key;
+    entries[i].max_key = max_key;
+    return i;
+}
+
+void ContainerWriter::close() {
+    if (!open) {
+        return;
+    }
+    open = false;
+    Bytes index = serialize_index(entries, end);
+    file.seekp(std::streamoff(end));
+    file.write(reinterpret_cast<const char*>(index.data()), std::streamsize(index.size()));
+    file.flush();
+    if (!file) {
+        throw std::runtime_error("container index write failed");
+    }
+    file.close();
+}
+
+ContainerReader::ContainerReader(const std::string &path) : file(path, std::ios::binary) {
+    if (!file) {
+        throw std::runtime_error("could not open container " + path);
+    }
+    uint64_t index_offset = 0;
+    entries = read_container_index(file, index_offset);
+}
+
+size_t ContainerReader::size() const {
+    return entries.size();
+}
+
+const ContainerEntry &ContainerReader::entry(size_t i) const {
+    if (i >= entries.size()) {
+        throw std::runtime_error("Index out of bounds");
+    }
+    return entries[i];
+}
+
+Bytes ContainerReader::read(size_t i) {
+    const ContainerEntry& e = entry(i);
+    Bytes frame(e.size);
+    file.seekg(std::streamoff(e.offset));
+    file.read(reinterpret_cast<char*>(frame.data()), std::streamsize(frame.size()));
+    if (!file) {
+        file.clear();
+        throw std::runtime_error("container record truncated");
+    }
+    return frame;
+}
@@ -0,0 +1,90 @@
+#pragma once
+#ifndef DTC_CONTAINER_H
+#define DTC_CONTAINER_H
+
+#include <fstream>
+#include <string>
+#include "Serial.h"
+
+// Container file (many records in one file, random access through an index at the end):
+//  - records: frames written with FRAME_SIZED, back to back
+//  - index: ContainerEntry[count], each:
+//      - offset: u64, size: u64, type_id: u64
+//      - has_keys: u8, min_key: i64, max_key: i64
+//  - footer:
+//      - index_offset: u64
+//      - count: u64
+//      - magic: u64 (CONTAINER_MAGIC)
+// entries are fixed size, so the index can be read (or patched) without parsing any record.
+// appending writes the new records over the old index and then writes a new index,
+// the existing records are never touched.
+
+const uint64_t CONTAINER_MAGIC = 0x5845444e49435444; // "DTCINDEX"
+const uint64_t CONTAINER_ENTRY_SIZE = 8 * 3 + 1 + 8 * 2;
+const uint64_t CONTAINER_FOOTER_SIZE = 8 * 3;
+
+struct ContainerEntry {
+    uint64_t offset = 0; // from the start of the file
+    uint64_t size = 0;
+    uint64_t type_id = 0;
+    bool has_keys = false;
+    int64_t min_key = 0;
+    int64_t max_key = 0;
+};
+
+// identifies the record type in the index (its fingerprint)
+uint64_t container_type_id(const Type& t);
+
+struct ContainerWriter {
+    std::fstream file;
+    std::vector<ContainerEntry> entries{};
+    uint64_t end = 0; // where the next record goes (the start of the old index)
+    bool open = false;
+
+    // creates the file, or opens an existing container to append to it
+    explicit ContainerWriter(const std::string& path);
+    ~ContainerWriter();
+
+    ContainerWriter(const ContainerWriter&) = delete;
+    ContainerWriter& operator=(const ContainerWriter&) = delete;
+
+    // frame must be sized (FRAME_SIZED), so the record is self-delimiting
+    size_t append_frame(const Bytes& frame, uint64_t type_id);
+    size_t append_frame(const Bytes& frame, uint64_t type_id, int64_t min_key, int64_t max_key);
+
+    template<typename T>
+    size_t append(const T& val, const Type& t, uint8_t flags=FRAME_DEFAULT) {
+        return append_frame(final_serialize(val, t, flags | FRAME_SIZED), container_type_id(t));
+    }
+
+    template<typename T>
+    size_t append(const T& val, const Type& t, int64_t min_key, int64_t max_key, uint8_t flags=FRAME_DEFAULT) {
+        return append_frame(final_serialize(val, t, flags | FRAME_SIZED), container_type_id(t), min_key, max_key);
+    }
+
+    // writes the index and footer, the writer can't be used after this
+    void close();
+};
+
+struct ContainerReader {
+    std::ifstream file;
+    std::vector<ContainerEntry> entries{};
+
+    explicit ContainerReader(const std::string& path);
+
+    [[nodiscard]] size_t size() const;
+    [[nodiscard]] const ContainerEntry& entry(size_t i) const;
+
+    // reads only record i (one seek)
+    Bytes read(size_t i);
+
+    template<typename T>
+    Deserialized<T> get(size_t i) {
+        return final_deserialize<T>(read(i));
+    }
+};
+
+// reads the index of an open container file, and the offset it starts at
+std::vector<ContainerEntry> read_container_index(std::istream& file, uint64_t& index_offset);
+
+#endif //DTC_CONTAINER_H
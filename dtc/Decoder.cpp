@@ -0,0 +1,342 @@
+#include "Decoder.h"
+
+// buffers aren't reserved past this up front, a header can claim any size
+static const uint64_t MAX_RESERVE = 1 << 20;
+
+// the smallest serialized type (an empty struct)
+static const uint64_t MIN_TYPE_SIZE = 8 + 1 + 8;
+
+static uint32_t load_u32(const std::byte* p) {
+    uint32_t v = 0;
+    for (int i = 0; i < 4; i++) {
+        v |= std::to_integer<uint32_t>(p[i]) << (i * 8);
+    }
+    return v;
+}
+
+// t_sizeof and the number of pointer slots (t_pointer_offsets(t).size()) of a type from an
+// untrusted header, without building anything. false if either doesn't fit in 64 bits
+static bool checked_layout(const Type& t, uint64_t& size, uint64_t& slots) {
+    if (t.deref_count > 0 || t.is_slice()) {
+        size = t.deref_count > 0 ? sizeof(void*) : sizeof(void*) + 8;
+        slots = 1;
+        return true;
+    }
+    size = 0;
+    slots = 0;
+    if (auto b = std::get_if<BasicType>(&t.type)) {
+        size = b->bytes;
+    } else if (auto s = std::get_if<StructType>(&t.type)) {
+        for (auto& field : s->types) {
+            uint64_t field_size, field_slots;
+            if (!checked_layout(field, field_size, field_slots) || field_size > UINT64_MAX - size) {
+                return false;
+            }
+            size += field_size;
+            slots += field_slots;
+        }
+    } else if (auto a = std::get_if<ArrayType>(&t.type)) {
+        uint64_t elem_size, elem_slots;
+        if (a->count == 0) {
+            return true;
+        }
+        if (!checked_layout(a->elem(), elem_size, elem_slots) ||
+            (elem_size != 0 && a->count > UINT64_MAX / elem_size)) {
+            return false;
+        }
+        // a slot is 8 bytes of the element, so this can't overflow once the size didn't
+        size = elem_size * a->count;
+        slots = elem_slots * a->count;
+    } else if (auto u = std::get_if<UnionType>(&t.type)) {
+        // slots depend on the tag, a union's value size isn't checked up front anyway
+        for (auto& member : u->types) {
+            uint64_t member_size, member_slots;
+            if (!checked_layout(member, member_size, member_slots)) {
+                return false;
+            }
+            size = std::max(size, member_size);
+        }
+        if (size > UINT64_MAX - 4) {
+            return false;
+        }
+        size += 4;
+    }
+    return true;
+}
+
+FrameDecoder::FrameDecoder(const Type &expected) : expected(&plan_for(expected)) {}
+
+void FrameDecoder::start() {
+    // the buffers keep their capacity, so a decoder that's reused stops allocating
+    stage = Head;
+    head_len = 0;
+    h = FrameHeader{};
+    body_bytes.clear();
+    ctx.clear();
+    body_crc = 0;
+    ctx_crc = 0;
+    header_len = 0;
+    scan = 0;
+    pending = 1;
+    typetype = -1;
+    parsed = Type();
+}
+
+bool FrameDecoder::in_frame() const {
+    return stage != Done && (stage != Head || head_len > 0);
+}
+
+void FrameDecoder::parse_head() {
+    const std::byte* p = head + 8;
+    if (h.flags & FRAME_SIZED) {
+        h.ctx_size = deserialize_u64(p);
+        p += 8;
+    }
+    if (h.flags & FRAME_FINGERPRINT) {
+        h.fingerprint = deserialize_u64(p);
+        p += 8;
+    }
+    if (h.flags & FRAME_CHECKSUM) {
+        h.body_crc = load_u32(p);
+        h.ctx_crc = load_u32(p + 4);
+    }
+
+    if (expected) {
+        // everything that can be checked before the body arrives
+        if ((h.flags & FRAME_FINGERPRINT) && h.fingerprint != expected->fingerprint) {
+            throw std::runtime_error("schema fingerprint mismatch");
+        }
+        if (h.body_size < expected->header.size()) {
+            throw std::runtime_error("schema fingerprint mismatch");
+        }
+        if (expected->flat) {
+            bool compact = (h.flags & FRAME_COMPACT_PTR) != 0;
+            uint64_t value_size = expected->size - (compact ? expected->pointers.size() * 4 : 0);
+            if (h.body_size != expected->header.size() + value_size) {
+                throw std::runtime_error("value size doesn't match the type");
+            }
+        }
+    }
+    body_bytes.reserve(std::min(h.body_size, MAX_RESERVE));
+    if (h.flags & FRAME_SIZED) {
+        ctx.reserve(std::min(h.ctx_size, MAX_RESERVE));
+    }
+}
+
+void FrameDecoder::walk_type_header() {
+    uint64_t have = body_bytes.size();
+    if (expected) {
+        uint64_t size = expected->header.size();
+        if (!(h.flags & FRAME_FINGERPRINT)) {
+            // compare what arrived so far to the expected header
+            uint64_t end = std::min(have, size);
+            if (!std::equal(body_bytes.begin() + std::ptrdiff_t(scan), body_bytes.begin() + std::ptrdiff_t(end),
+                            expected->header.begin() + std::ptrdiff_t(scan))) {
+                throw std::runtime_error("schema fingerprint mismatch");
+            }
+            scan = end;
+            if (scan == size) {
+                header_len = size;
+            }
+        } else if (have >= size) {
+            header_len = size;
+        }
+        return;
+    }
+
+    // a serialized type is its deref count and typetype, then a fixed size part that depends on the
+    // typetype, then the types in it. the types are in preorder, so the walk only has to count
+    // how many are still to come
+    const std::byte* b = body_bytes.data();
+    while (pending > 0) {
+        if (typetype < 0) {
+            if (have - scan < 9) {
+                return;
+            }
+            typetype = std::to_integer<int>(b[scan + 8]);
+            if (typetype > 4) {
+                throw std::runtime_error("unknown typetype");
+            }
+            scan += 9;
+        }
+        uint64_t need = typetype == 2 ? 1 : (typetype == 0 ? 9 : 8);
+        if (have - scan < need) {
+            return;
+        }
+        uint64_t inner = 0;
+        if (typetype == 1 || typetype == 4) {
+            inner = deserialize_u64(b + scan);
+        } else if (typetype == 2 || typetype == 3) {
+            inner = 1;
+        }
+        scan += need;
+        pending--;
+        typetype = -1;
+        // each type takes at least MIN_TYPE_SIZE bytes, so a count that can't fit is caught here
+        // instead of after the whole body has been received
+        uint64_t room = (h.body_size - scan) / MIN_TYPE_SIZE;
+        if (pending > room || inner > room - pending) {
+            throw std::runtime_error("type header is past the end of the body");
+        }
+        pending += inner;
+    }
+    header_len = scan;
+    ByteStream stream(ByteSpan(b, header_len));
+    parsed = deserialize_type(stream);
+    uint64_t fingerprint = parsed.fingerprint();
+    if ((h.flags & FRAME_FINGERPRINT) && h.fingerprint != fingerprint) {
+        throw std::runtime_error("schema fingerprint mismatch");
+    }
+    // the size is checked before anything is built for the type, so a header that claims a huge
+    // value is rejected for what it costs to walk it
+    if (!t_has_union(parsed)) {
+        uint64_t size, slots;
+        bool compact = (h.flags & FRAME_COMPACT_PTR) != 0;
+        if (!checked_layout(parsed, size, slots) ||
+            h.body_size - header_len != size - (compact ? slots * 4 : 0)) {
+            throw std::runtime_error("value size doesn't match the type");
+        }
+    }
+    // the plan is the decoder's own, a peer sending many types can't grow plan_for's cache.
+    // frames of the same type in a row share it
+    if (!parsed_plan || parsed_plan->fingerprint != fingerprint || !(parsed_plan->type == parsed)) {
+        parsed_plan = std::make_unique<const Plan>(parsed);
+    }
+}
+
+FrameDecoder::Status FrameDecoder::complete() {
+    if ((h.flags & FRAME_CHECKSUM) && (body_crc != h.body_crc || ctx_crc != h.ctx_crc)) {
+        throw std::runtime_error("frame checksum mismatch");
+    }
+    if (!(h.flags & FRAME_SIZED)) {
+        h.ctx_size = ctx.size();
+    }
+    stage = Done;
+    return Complete;
+}
+
+FrameDecoder::Status FrameDecoder::feed(ByteSpan bytes, size_t &used) {
+    if (stage == Done) {
+        start();
+    }
+    used = 0;
+    for (;;) {
+        const std::byte* p = bytes.data() + used;
+        size_t avail = bytes.size() - used;
+        if (stage == Head) {
+            uint64_t want = (head_len < 8 ? 8 : h.header_size) - head_len;
+            uint64_t n = std::min<uint64_t>(want, avail);
+            if (n > 0) {
+                std::memcpy(head + head_len, p, n);
+            }
+            head_len += n;
+            used += n;
+            if (n < want) {
+                return NeedMore;
+            }
+            if (h.header_size == 0) {
+                uint64_t word = deserialize_u64(head);
+                h.flags = uint8_t(word >> 56);
+                h.body_size = word & FRAME_SIZE_MASK;
+                if (h.flags & ~FRAME_KNOWN_FLAGS) {
+                    throw std::runtime_error("frame has flags this version doesn't know");
+                }
+                h.header_size = frame_header_size(h.flags);
+                continue;
+            }
+            parse_head();
+            stage = Body;
+        } else if (stage == Body) {
+            uint64_t n = std::min<uint64_t>(h.body_size - body_bytes.size(), avail);
+            body_bytes.insert(body_bytes.end(), p, p + n);
+            used += n;
+            if (h.flags & FRAME_CHECKSUM) {
+                body_crc = crc32c(body_crc, p, n);
+            }
+            if (header_len == 0) {
+                walk_type_header();
+            }
+            if (body_bytes.size() < h.body_size) {
+                return NeedMore;
+            }
+            if (header_len == 0) {
+                throw std::runtime_error("type header is past the end of the body");
+            }
+            stage = Ctx;
+        } else if (stage == Ctx) {
+            uint64_t n = avail;
+            if (h.flags & FRAME_SIZED) {
+                n = std::min<uint64_t>(h.ctx_size - ctx.size(), avail);
+            }
+            ctx.insert(ctx.end(), p, p + n);
+            used += n;
+            if (h.flags & FRAME_CHECKSUM) {
+                ctx_crc = crc32c(ctx_crc, p, n);
+            }
+            if (!(h.flags & FRAME_SIZED) || ctx.size() < h.ctx_size) {
+                // an unsized frame only ends with the input
+                return NeedMore;
+            }
+            return complete();
+        } else {
+            return Complete;
+        }
+    }
+}
+
+FrameDecoder::Status FrameDecoder::finish() {
+    if (stage == Done || !in_frame()) {
+        return NeedMore;
+    }
+    if (stage == Ctx && !(h.flags & FRAME_SIZED)) {
+        return complete();
+    }
+    throw std::runtime_error("frame truncated");
+}
+
+static void check_done(bool done) {
+    if (!done) {
+        throw std::runtime_error("no complete frame in the decoder");
+    }
+}
+
+const FrameHeader &FrameDecoder::header() const {
+    check_done(stage == Done);
+    return h;
+}
+
+const Type &FrameDecoder::type() const {
+    check_done(stage == Done);
+    return expected ? expected->type : parsed;
+}
+
+ByteSpan FrameDecoder::body() const {
+    check_done(stage == Done);
+    return body_bytes;
+}
+
+Context &FrameDecoder::context() {
+    check_done(stage == Done);
+    return ctx;
+}
+
+Variable FrameDecoder::variable() const {
+    check_done(stage == Done);
+    uint64_t fingerprint = expected ? expected->fingerprint : parsed_plan->fingerprint;
+    if (h.flags & FRAME_COMPACT_PTR) {
+        ByteStream stream(widen_body(body_bytes));
+        return deserialize_variable(stream, type(), fingerprint);
+    }
+    ByteStream stream{ByteSpan(body_bytes)};
+    // the type header was already checked (or parsed) on the way in, the fingerprint skips it
+    return deserialize_variable(stream, type(), fingerprint);
+}
+
+void FrameDecoder::decode_into(void *out, uint64_t size, const Context &c) const {
+    check_done(stage == Done);
+    const Plan& plan = expected ? *expected : *parsed_plan;
+    if (size != plan.size) {
+        throw std::runtime_error("primitive type size mismatch");
+    }
+    plan_decode(plan, body_bytes, c, out, plan.fingerprint, (h.flags & FRAME_COMPACT_PTR) != 0);
+}
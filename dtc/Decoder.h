@@ -0,0 +1,95 @@
+#pragma once
+#ifndef DTC_DECODER_H
+#define DTC_DECODER_H
+
+#include <memory>
+#include "Plan.h"
+
+// decoding frames from bytes as they arrive (a socket, a pipe, a file read in chunks), instead of
+// buffering a whole record before final_deserialize can start on it.
+// feed() takes whatever bytes are there, in pieces of any size, and says whether a frame is complete.
+// every byte is looked at once, when it arrives: the frame header is parsed as soon as it's all
+// there, the type header is walked (or compared to the expected type's) as its bytes come in, and
+// the checksums are updated piece by piece, so a bad record is rejected before the rest of it is
+// received and nothing is rescanned at the end.
+// frames are delimited by their header, so a stream of them has to be FRAME_SIZED, except for the
+// last one which can end with the input (finish()).
+
+struct FrameDecoder {
+    enum Status : uint8_t {
+        NeedMore, // every byte given was used and the frame isn't complete yet
+        Complete, // a whole frame is in, the bytes after it weren't used
+    };
+
+    // decodes frames of any type, the type is read from each frame's type header
+    FrameDecoder() = default;
+
+    // decodes frames of type expected only, throws as soon as a frame turns out to be something else
+    explicit FrameDecoder(const Type& expected);
+
+    // consumes bytes up to the end of the current frame, used is how many that was. after Complete
+    // the next feed starts a new frame, and the one before it is gone
+    Status feed(ByteSpan bytes, size_t& used);
+
+    // the end of the input. completes a frame without FRAME_SIZED (its context is everything that
+    // came after the body), NeedMore if there was no frame in progress. throws if one is cut off
+    Status finish();
+
+    // true while part of a frame has been fed
+    [[nodiscard]] bool in_frame() const;
+
+    // the frame that completed, valid until the next feed
+
+    [[nodiscard]] const FrameHeader& header() const;
+    [[nodiscard]] const Type& type() const;
+    [[nodiscard]] ByteSpan body() const; // as it was in the frame, compact pointers and all
+    [[nodiscard]] Context& context();
+
+    // the value, like deserialize_variable on the body (pointers are offsets into context())
+    [[nodiscard]] Variable variable() const;
+
+    // decodes the value into out (size bytes, the type's size) with its pointers into ctx, which has
+    // to hold the frame's context (context(), or moved out of it)
+    void decode_into(void* out, uint64_t size, const Context& ctx) const;
+
+    // the value with a context of its own, moved out of context()
+    template<typename T>
+    Deserialized<T> take() {
+        Deserialized<T> res{T{}, new Context(std::move(ctx))};
+        try {
+            decode_into(&res.val, sizeof(T), *res.ctx);
+            return res;
+        } catch (...) {
+            delete res.ctx;
+            throw;
+        }
+    }
+
+private:
+    enum Stage : uint8_t { Head, Body, Ctx, Done };
+
+    const Plan* expected = nullptr;
+    Stage stage = Head;
+    std::byte head[40]{}; // the largest frame header
+    uint64_t head_len = 0;
+    FrameHeader h{};
+    Bytes body_bytes{};
+    Context ctx{};
+    uint32_t body_crc = 0;
+    uint32_t ctx_crc = 0;
+
+    // the type header, walked as it arrives
+    uint64_t header_len = 0; // known once the type header is complete, 0 before
+    uint64_t scan = 0; // how far it's been walked (or compared)
+    uint64_t pending = 1; // types whose bytes haven't all been walked
+    int typetype = -1; // of the type being walked, -1 before its deref count and typetype are in
+    Type parsed{};
+    std::unique_ptr<const Plan> parsed_plan{}; // for parsed, not in plan_for's cache
+
+    void start();
+    void parse_head();
+    void walk_type_header();
+    Status complete();
+};
+
+#endif //DTC_DECODER_H
@@ -0,0 +1,296 @@
+#include "Delta.h"
+
+static bool is_string_pointee(const Type& t) {
+    auto b = std::get_if<BasicType>(&t.type);
+    return t.deref_count == 0 && b && b->bytes == 1 && !b->sign && !b->floating;
+}
+
+static void collect_leaves(const Type& t, uint64_t offset, std::vector<DeltaLeaf>& out) {
+    DeltaLeaf l;
+    l.offset = offset;
+    if (t.deref_count > 0) {
+        Type pointee = t.deref();
+        l.kind = DeltaLeaf::Pointer;
+        l.size = t_sizeof(pointee);
+        l.string = is_string_pointee(pointee);
+    } else if (auto sl = std::get_if<SliceType>(&t.type)) {
+        l.kind = DeltaLeaf::Slice;
+        l.size = t_sizeof(sl->elem());
+        l.string = sl->string;
+    } else if (auto b = std::get_if<BasicType>(&t.type)) {
+        bool word = b->bytes == 1 || b->bytes == 2 || b->bytes == 4 || b->bytes == 8;
+        if (b->floating && (b->bytes == 4 || b->bytes == 8)) {
+            l.kind = DeltaLeaf::Float;
+        } else if (!b->floating && word) {
+            l.kind = DeltaLeaf::Int;
+        }
+        l.size = b->bytes;
+        if (l.size == 0) {
+            return; // nothing to encode
+        }
+    } else if (auto s = std::get_if<StructType>(&t.type)) {
+        for (auto& field : s->types) {
+            collect_leaves(field, offset, out);
+            offset += t_sizeof(field);
+        }
+        return;
+    } else if (auto a = std::get_if<ArrayType>(&t.type)) {
+        uint64_t size = t_sizeof(a->elem());
+        for (uint64_t i = 0; i < a->count; i++) {
+            collect_leaves(a->elem(), offset + i * size, out);
+        }
+        return;
+    } else if (t.is_union()) {
+        // the members overlap, so the whole union (tag included) is one raw leaf
+        if (t_has_pointers(t)) {
+            throw std::runtime_error("delta encoding doesn't support unions with pointers");
+        }
+        l.size = t_sizeof(t);
+    }
+    out.push_back(l);
+}
+
+std::vector<DeltaLeaf> delta_leaves(const Type &t) {
+    std::vector<DeltaLeaf> leaves;
+    collect_leaves(t, 0, leaves);
+    return leaves;
+}
+
+bool delta_is_keyframe(ByteSpan record) {
+    return record.size() > 0 && (std::to_integer<uint8_t>(record[0]) & DELTA_KEYFRAME);
+}
+
+static uint64_t load_le(const std::byte* p, uint64_t size) {
+    uint64_t v = 0;
+    for (uint64_t i = 0; i < size; i++) {
+        v |= std::to_integer<uint64_t>(p[i]) << (i * 8);
+    }
+    return v;
+}
+
+static void store_le(std::byte* p, uint64_t size, uint64_t v) {
+    for (uint64_t i = 0; i < size; i++) {
+        p[i] = std::byte(v >> (i * 8));
+    }
+}
+
+static void put_varint(Bytes& out, uint64_t v) {
+    while (v >= 0x80) {
+        out.push_back(std::byte((v & 0x7F) | 0x80));
+        v >>= 7;
+    }
+    out.push_back(std::byte(v));
+}
+
+static void put_bytes(Bytes& out, const void* p, uint64_t size) {
+    auto* b = static_cast<const std::byte*>(p);
+    out.insert(out.end(), b, b + size);
+}
+
+// the difference of two size-byte integers, sign extended and zig-zag encoded.
+// the difference wraps, so it works the same for signed and unsigned values
+static uint64_t int_delta(uint64_t cur, uint64_t prev, uint64_t size) {
+    unsigned shift = unsigned(64 - size * 8);
+    auto d = int64_t((cur - prev) << shift) >> shift;
+    return (uint64_t(d) << 1) ^ uint64_t(d >> 63);
+}
+
+static uint64_t apply_int_delta(uint64_t prev, uint64_t z) {
+    uint64_t d = (z >> 1) ^ (~(z & 1) + 1);
+    return prev + d;
+}
+
+DeltaEncoder::DeltaEncoder(const Type &t, uint64_t keyframe_interval)
+        : leaves(delta_leaves(t)), fingerprint(t.fingerprint()), value_size(t_sizeof(t)),
+          keyframe_interval(std::max<uint64_t>(keyframe_interval, 1)) {
+    prev.resize(value_size);
+    prev_pointees.resize(leaves.size());
+    prev_null.resize(leaves.size(), true);
+}
+
+void DeltaEncoder::force_keyframe() {
+    need_keyframe = true;
+}
+
+void DeltaEncoder::encode_into(const void *val, Bytes &out) {
+    auto* cur = static_cast<const std::byte*>(val);
+    bool keyframe = need_keyframe || since_keyframe >= keyframe_interval;
+    if (keyframe) {
+        std::fill(prev.begin(), prev.end(), std::byte(0));
+        since_keyframe = 0;
+        need_keyframe = false;
+    }
+    since_keyframe++;
+
+    out.push_back(std::byte(keyframe ? DELTA_KEYFRAME : 0));
+    if (keyframe) {
+        put_bytes(out, serialize_u64(fingerprint).data(), 8);
+    }
+    size_t bitmap = out.size();
+    out.resize(out.size() + (leaves.size() + 7) / 8);
+
+    for (size_t i = 0; i < leaves.size(); i++) {
+        const DeltaLeaf& l = leaves[i];
+        const std::byte* c = cur + l.offset;
+        const std::byte* p = prev.data() + l.offset;
+        bool changed = keyframe;
+        if (l.kind == DeltaLeaf::Int) {
+            uint64_t z = int_delta(load_le(c, l.size), load_le(p, l.size), l.size);
+            if (z != 0 || keyframe) {
+                put_varint(out, z);
+                changed = true;
+            }
+        } else if (l.kind == DeltaLeaf::Float) {
+            uint64_t x = load_le(c, l.size) ^ load_le(p, l.size);
+            if (x != 0 || keyframe) {
+                put_varint(out, x);
+                changed = true;
+            }
+        } else if (l.kind == DeltaLeaf::Raw) {
+            if (keyframe || std::memcmp(c, p, l.size) != 0) {
+                put_bytes(out, c, l.size);
+                changed = true;
+            }
+        } else if (l.kind == DeltaLeaf::Pointer) {
+            const void* ptr = nullptr;
+            std::memcpy(&ptr, c, sizeof(void*));
+            uint64_t size = ptr == nullptr ? 0 : (l.string ? std::strlen(static_cast<const char*>(ptr)) + 1 : l.size);
+            Bytes& pp = prev_pointees[i];
+            bool same = (ptr == nullptr) == prev_null[i] && pp.size() == size &&
+                        (size == 0 || std::memcmp(pp.data(), ptr, size) == 0);
+            if (keyframe || !same) {
+                put_varint(out, ptr == nullptr ? 0 : size + 1);
+                put_bytes(out, ptr, size);
+                auto* b = static_cast<const std::byte*>(ptr);
+                pp.assign(b, b + size);
+                prev_null[i] = ptr == nullptr;
+                changed = true;
+            }
+        } else {
+            const void* ptr = nullptr;
+            std::memcpy(&ptr, c, sizeof(void*));
+            uint64_t count = load_le(c + sizeof(void*), 8);
+            uint64_t size = count * l.size;
+            Bytes& pp = prev_pointees[i];
+            bool same = load_le(p + sizeof(void*), 8) == count && pp.size() == size &&
+                        (size == 0 || std::memcmp(pp.data(), ptr, size) == 0);
+            if (keyframe || !same) {
+                put_varint(out, count);
+                put_bytes(out, ptr, size);
+                auto* b = static_cast<const std::byte*>(ptr);
+                pp.assign(b, b + size);
+                changed = true;
+            }
+        }
+        if (changed) {
+            out[bitmap + i / 8] |= std::byte(1 << (i % 8));
+        }
+    }
+    std::memcpy(prev.data(), cur, value_size);
+}
+
+namespace {
+
+struct DeltaReader {
+    ByteSpan record;
+    size_t pos = 0;
+
+    void need(uint64_t n) const {
+        if (record.size() - pos < n) {
+            throw std::runtime_error("delta record truncated");
+        }
+    }
+
+    uint64_t varint() {
+        uint64_t v = 0;
+        for (unsigned shift = 0; shift < 64; shift += 7) {
+            need(1);
+            auto b = std::to_integer<uint64_t>(record[pos++]);
+            v |= (b & 0x7F) << shift;
+            if (!(b & 0x80)) {
+                return v;
+            }
+        }
+        throw std::runtime_error("delta varint too long");
+    }
+
+    const std::byte* bytes(uint64_t n) {
+        need(n);
+        const std::byte* p = record.data() + pos;
+        pos += n;
+        return p;
+    }
+};
+
+}
+
+DeltaDecoder::DeltaDecoder(const Type &t)
+        : leaves(delta_leaves(t)), fingerprint(t.fingerprint()), value_size(t_sizeof(t)) {
+    prev.resize(value_size);
+    pointees.resize(leaves.size());
+    null.resize(leaves.size(), true);
+}
+
+void DeltaDecoder::decode_into(ByteSpan record, void *out) {
+    DeltaReader r{record};
+    uint8_t flags = std::to_integer<uint8_t>(*r.bytes(1));
+    bool keyframe = flags & DELTA_KEYFRAME;
+    if (keyframe) {
+        if (deserialize_u64(r.bytes(8)) != fingerprint) {
+            throw std::runtime_error("delta stream has a different type");
+        }
+        std::fill(prev.begin(), prev.end(), std::byte(0));
+        started = true;
+    } else if (!started) {
+        throw std::runtime_error("delta stream has to start at a keyframe");
+    }
+    const std::byte* bitmap = r.bytes((leaves.size() + 7) / 8);
+
+    for (size_t i = 0; i < leaves.size(); i++) {
+        if (!(std::to_integer<uint8_t>(bitmap[i / 8]) & (1 << (i % 8)))) {
+            continue;
+        }
+        const DeltaLeaf& l = leaves[i];
+        std::byte* p = prev.data() + l.offset;
+        if (l.kind == DeltaLeaf::Int) {
+            store_le(p, l.size, apply_int_delta(load_le(p, l.size), r.varint()));
+        } else if (l.kind == DeltaLeaf::Float) {
+            store_le(p, l.size, load_le(p, l.size) ^ r.varint());
+        } else if (l.kind == DeltaLeaf::Raw) {
+            std::memcpy(p, r.bytes(l.size), l.size);
+        } else if (l.kind == DeltaLeaf::Pointer) {
+            uint64_t n = r.varint();
+            null[i] = n == 0;
+            uint64_t size = n == 0 ? 0 : n - 1;
+            if (n != 0 && (l.string ? size == 0 : size != l.size)) {
+                throw std::runtime_error("delta pointee size mismatch");
+            }
+            const std::byte* b = r.bytes(size);
+            if (l.string && n != 0 && b[size - 1] != std::byte(0)) {
+                throw std::runtime_error("delta string is not terminated");
+            }
+            pointees[i].assign(b, b + size);
+        } else {
+            uint64_t count = r.varint();
+            if (l.size != 0 && count > (record.size() - r.pos) / l.size) {
+                throw std::runtime_error("delta record truncated");
+            }
+            const std::byte* b = r.bytes(count * l.size);
+            pointees[i].assign(b, b + count * l.size);
+            if (l.string) {
+                pointees[i].push_back(std::byte(0)); // like the context, a string slice is terminated
+            }
+            store_le(p + sizeof(void*), 8, count);
+        }
+    }
+
+    auto* dst = static_cast<std::byte*>(out);
+    std::memcpy(dst, prev.data(), value_size);
+    for (size_t i = 0; i < leaves.size(); i++) {
+        const DeltaLeaf& l = leaves[i];
+        if (l.kind == DeltaLeaf::Pointer || l.kind == DeltaLeaf::Slice) {
+            const std::byte* ptr = null[i] && l.kind == DeltaLeaf::Pointer ? nullptr : pointees[i].data();
+            std::memcpy(dst + l.offset, &ptr, sizeof(void*));
+        }
+    }
+}
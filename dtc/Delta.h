@@ -0,0 +1,103 @@
+#pragma once
+#ifndef DTC_DELTA_H
+#define DTC_DELTA_H
+
+#include "Serial.h"
+
+// encoding a stream of values of one type as differences from the value before.
+// the type is flattened into leaves (integers, floats, pointers, slices) and each record has a
+// bitmap of the leaves that changed, followed by the change of each of them:
+//  - integers: the difference, zig-zag encoded varint (small changes either way are 1 byte)
+//  - floats: the bits XOR'd with the previous value's, as a varint (same sign and exponent is short)
+//  - pointers and slices: the whole pointee again, only if its bytes changed
+// every keyframe_interval records (and the first one) is a keyframe, encoded against all zeroes,
+// so a decoder can start at any keyframe.
+
+// Delta record:
+//  - flags: u8 (1 for a keyframe)
+//  - [keyframe] fingerprint: u64 (Type::fingerprint of the stream's type)
+//  - changed: (leaves + 7) / 8 bytes, bit i set if leaf i follows
+//  - for each changed leaf, in order:
+//     - integer: zig-zag varint of (value - previous)
+//     - float: varint of (bits ^ previous bits)
+//     - other basic sizes: the raw bytes
+//     - pointer: varint (0 for null, otherwise pointee size + 1), then the pointee's bytes
+//     - slice: varint count, then the elements' bytes
+
+struct DeltaLeaf {
+    enum Kind : uint8_t { Int, Float, Raw, Pointer, Slice };
+    Kind kind = Raw;
+    uint64_t offset = 0; // in the value
+    uint64_t size = 0; // of the value's bytes, or of a pointee / slice element
+    bool string = false; // null-terminated pointee, or string slice
+};
+
+// the leaves of t in the order they're encoded
+std::vector<DeltaLeaf> delta_leaves(const Type& t);
+
+const uint8_t DELTA_KEYFRAME = 1;
+
+// true if a record can be decoded without the records before it
+bool delta_is_keyframe(ByteSpan record);
+
+struct DeltaEncoder {
+    explicit DeltaEncoder(const Type& t, uint64_t keyframe_interval=64);
+
+    // appends the record for val (a value of the encoder's type, value_size bytes) to out
+    void encode_into(const void* val, Bytes& out);
+
+    template<typename T>
+    Bytes encode(const T& val) {
+        if (sizeof(T) != value_size) {
+            throw std::runtime_error("delta value size mismatch");
+        }
+        Bytes out;
+        encode_into(&val, out);
+        return out;
+    }
+
+    // the next record will be a keyframe
+    void force_keyframe();
+
+private:
+    std::vector<DeltaLeaf> leaves;
+    uint64_t fingerprint;
+    uint64_t value_size;
+    uint64_t keyframe_interval;
+    uint64_t since_keyframe = 0;
+    bool need_keyframe = true;
+    Bytes prev{};
+    std::vector<Bytes> prev_pointees{};
+    std::vector<bool> prev_null{};
+};
+
+// decodes what a DeltaEncoder for the same type produced, records have to be fed in order
+// starting at a keyframe. pointers in decoded values point into the decoder, and stay valid
+// until the next decode
+struct DeltaDecoder {
+    explicit DeltaDecoder(const Type& t);
+
+    // decodes a record into out (value_size bytes)
+    void decode_into(ByteSpan record, void* out);
+
+    template<typename T>
+    T decode(ByteSpan record) {
+        if (sizeof(T) != value_size) {
+            throw std::runtime_error("delta value size mismatch");
+        }
+        T res;
+        decode_into(record, &res);
+        return res;
+    }
+
+private:
+    std::vector<DeltaLeaf> leaves;
+    uint64_t fingerprint;
+    uint64_t value_size;
+    bool started = false;
+    Bytes prev{};
+    std::vector<Bytes> pointees{};
+    std::vector<bool> null{};
+};
+
+#endif //DTC_DELTA_H
@@ -1,127 +1,200 @@
 #include "DynTypC.h"
+#include "Visit.h"
 
-void printType(const Type &t) {
-    // if basicType
-    if (auto b = std::get_if<BasicType>(&t.type)) {
-        if (b->floating) {
-            std::cout << std::dec <<  "f" << (b->bytes * 8);
+namespace {
+
+struct TypePrinter {
+    void print(const Type& t) {
+        visit_kind(t, *this);
+        for (uint64_t i = 0; i < t.deref_count; i++) {
+            std::cout << "*";
+        }
+    }
+
+    void on_basic(const Type&, const BasicType& b) {
+        if (b.floating) {
+            std::cout << std::dec <<  "f" << (b.bytes * 8);
         } else {
-            std::cout << std::dec << (b->sign ? "i" : "u") << (b->bytes * 8);
+            std::cout << std::dec << (b.sign ? "i" : "u") << (b.bytes * 8);
         }
-    } else if (auto s = std::get_if<StructType>(&t.type)) {
+    }
+
+    void on_struct(const Type&, const StructType& s) {
         std::cout << "struct {";
-        for (size_t i = 0; i < s->types.size(); i++) {
-            printType(s->types[i]);
-            if (i != s->types.size() - 1) {
-                std::cout << ", ";
-            }
+        list(s.types);
+        std::cout << "}";
+    }
+
+    void on_slice(const Type&, const SliceType& sl) {
+        if (sl.string) {
+            std::cout << "str";
+        } else {
+            std::cout << "slice<";
+            print(sl.elem());
+            std::cout << ">";
         }
+    }
+
+    void on_array(const Type&, const ArrayType& a) {
+        print(a.elem());
+        std::cout << "[" << std::dec << a.count << "]";
+    }
+
+    void on_union(const Type&, const UnionType& u) {
+        std::cout << "union {";
+        list(u.types);
         std::cout << "}";
     }
-    for (uint64_t i = 0; i < t.deref_count; i++) {
-        std::cout << "*";
+
+    void list(const std::vector<Type>& types) {
+        for (size_t i = 0; i < types.size(); i++) {
+            print(types[i]);
+            if (i != types.size() - 1) {
+                std::cout << ", ";
+            }
+        }
     }
+};
+
+template<typename T>
+T load(const std::byte* data) {
+    T v;
+    std::memcpy(&v, data, sizeof(T));
+    return v;
 }
 
-void printVariable(Context& ctx, Variable v, bool done) {
-    if (v.type.deref_count > 0) {
-        if (v.data.size() != sizeof(void*)) {
-            throw std::runtime_error("pointer size mismatch");
-        }
-        printType(v.type);
-        std::cout << "(0x" << std::hex << *(void**)v.data.data() << ")";
-        if (done) {
-            std::cout << std::endl;
-        }
-        return;
+// prints a value in place, members are read where they are instead of copied out into Variables
+struct ValuePrinter {
+    void on_pointer(const Type& t, const std::byte* data) {
+        printType(t);
+        std::cout << "(0x" << std::hex << load<void*>(data) << ")";
     }
-    if (v.is_basic()) {
-        printType(v.type);
+
+    void on_slice(const Type& t, const SliceType&, const std::byte* data) {
+        printType(t);
+        std::cout << "(0x" << std::hex << load<void*>(data) << ", " << std::dec << load<uint64_t>(data + sizeof(void*)) << ")";
+    }
+
+    void on_basic(const Type& t, const BasicType& b, const std::byte* data) {
+        printType(t);
         std::cout << "(";
-        if (auto s = std::get_if<BasicType>(&v.type.type)) {
-            if (s->floating) {
-                if (s->bytes == 4) {
-                    std::cout << std::dec << primitive<f32>(ctx, v);
-                } else if (s->bytes == 8) {
-                    std::cout << std::dec << primitive<f64>(ctx, v);
-                }
-            } else {
-                if (s->sign) {
-                    if (s->bytes == 1) {
-                        std::cout << (int)primitive<i8>(ctx, v);
-                    } else if (s->bytes == 2) {
-                        std::cout << primitive<i16>(ctx, v);
-                    } else if (s->bytes == 4) {
-                        std::cout << primitive<i32>(ctx, v);
-                    } else if (s->bytes == 8) {
-                        std::cout << primitive<i64>(ctx, v);
-                    }
-                } else {
-                    if (s->bytes == 1) {
-                        std::cout << (int)primitive<u8>(ctx, v);
-                    } else if (s->bytes == 2) {
-                        std::cout << primitive<u16>(ctx, v);
-                    } else if (s->bytes == 4) {
-                        std::cout << primitive<u32>(ctx, v);
-                    } else if (s->bytes == 8) {
-                        std::cout << primitive<u64>(ctx, v);
-                    }
-                }
+        if (b.floating) {
+            if (b.bytes == 4) {
+                std::cout << std::dec << load<f32>(data);
+            } else if (b.bytes == 8) {
+                std::cout << std::dec << load<f64>(data);
+            }
+        } else if (b.sign) {
+            if (b.bytes == 1) {
+                std::cout << (int)load<i8>(data);
+            } else if (b.bytes == 2) {
+                std::cout << load<i16>(data);
+            } else if (b.bytes == 4) {
+                std::cout << load<i32>(data);
+            } else if (b.bytes == 8) {
+                std::cout << load<i64>(data);
             }
         } else {
-            throw std::runtime_error("variable is not basic type");
+            if (b.bytes == 1) {
+                std::cout << (int)load<u8>(data);
+            } else if (b.bytes == 2) {
+                std::cout << load<u16>(data);
+            } else if (b.bytes == 4) {
+                std::cout << load<u32>(data);
+            } else if (b.bytes == 8) {
+                std::cout << load<u64>(data);
+            }
         }
         std::cout << ")";
-    } else {
-        if (auto s = std::get_if<StructType>(&v.type.type)) {
-            std::cout << "struct";
-            for (uint64_t i = 0; i < v.type.deref_count; i++) {
-                std::cout << "*";
-            }
-            std::cout << " {";
-            for (size_t i = 0; i < s->types.size(); i++) {
-                Variable sub = v.getsub(i);
-                printVariable(ctx, sub, false);
-                if (i != s->types.size() - 1) {
-                    std::cout << ", ";
-                }
+    }
+
+    void on_struct(const Type& t, const StructType&, const std::byte* data) {
+        std::cout << "struct {";
+        members(t, data);
+        std::cout << "}";
+    }
+
+    void on_array(const Type& t, const ArrayType&, const std::byte* data) {
+        printType(t);
+        std::cout << " {";
+        members(t, data);
+        std::cout << "}";
+    }
+
+    void on_union(const Type& t, const UnionType& u, const std::byte* data) {
+        // just the active member, the others' bytes mean nothing
+        std::cout << "union " << std::dec << union_tag(u, data) << " {";
+        members(t, data);
+        std::cout << "}";
+    }
+
+    void members(const Type& t, const std::byte* data) {
+        bool first = true;
+        for_each_member(t, data, [&](const Type& member, const std::byte* d) {
+            if (!first) {
+                std::cout << ", ";
             }
-            std::cout << "}";
-        } else {
-            throw std::runtime_error("variable is not struct type");
-        }
+            first = false;
+            visit_value(member, d, *this);
+            return true;
+        });
     }
+};
+
+} // namespace
+
+void printType(const Type &t) {
+    TypePrinter{}.print(t);
+}
+
+void printVariable(Context&, const Variable& v, bool done) {
+    if (v.type.deref_count > 0 && v.data.size() != sizeof(void*)) {
+        throw std::runtime_error("pointer size mismatch");
+    }
+    if (v.type.deref_count == 0 && v.type.is_slice() && v.data.size() != sizeof(void*) + 8) {
+        throw std::runtime_error("slice size mismatch");
+    }
+    if (v.data.size() < t_sizeof(v.type)) {
+        throw std::runtime_error("variable is smaller than its type");
+    }
+    visit_value(v.type, v.data.data(), ValuePrinter{});
     if (done) {
         std::cout << std::endl;
     }
 }
 
-Variable sanitizePointers(Context& ctx, Variable v) {
-    // if the type is a pointer, we must sanitize it by allocating memory for the data and copying it from virtual memory
-    // we need to recurse for structs
-    if (auto s = std::get_if<StructType>(&v.type.type)) {
-        Variable v2 = v;
-        v2.data.clear();
-        for (size_t i = 0; i < s->types.size(); i++) {
-            Variable sub = v.getsub(ctx, i);
-            Variable sanitized = sanitizePointers(ctx, sub);
-            v2.data.insert(v2.data.end(), sanitized.data.begin(), sanitized.data.end());
-        }
-        return v2;
-    } else if (v.type.deref_count > 0 && !v.type.sanitized) {
+// adds ctx's address to every pointer slot in data, which holds a value of type t
+static void sanitize_in_place(const Context& ctx, const Type& t, std::byte* data) {
+    if (t.sanitized) {
+        return;
+    }
+    for_each_pointer(t, data, [&](const Type&, std::byte* slot) {
+        // for slices only the pointer half changes, the count stays
         uint64_t ptr = 0;
         for (size_t i = 0; i < sizeof(void*); i++) {
-            ptr |= std::to_integer<uint64_t>(v.data[i]) << (i * 8);
+            ptr |= std::to_integer<uint64_t>(slot[i]) << (i * 8);
         }
         auto ptr2 = (size_t)(ptr+ctx.data());
-        v.data.clear();
-        v.data.resize(sizeof(void*));
         for (size_t i = 0; i < sizeof(void*); i++) {
-            v.data[i] = std::byte((ptr2 >> (i * 8)) & 0xFF);
+            slot[i] = std::byte((ptr2 >> (i * 8)) & 0xFF);
         }
+        return true;
+    });
+}
+
+Variable sanitizePointers(const Context& ctx, Variable&& v) {
+    // if the type is a pointer, we must sanitize it by allocating memory for the data and copying it from virtual memory
+    // we need to recurse for structs
+    if (v.data.size() < t_sizeof(v.type)) {
+        throw std::runtime_error("variable is smaller than its type");
+    }
+    sanitize_in_place(ctx, v.type, v.data.data());
+    if (v.type.deref_count > 0 || v.type.is_slice()) {
         v.type.sanitized = true;
-        return v;
-    } else {
-        return v;
     }
+    return std::move(v);
+}
+
+Variable sanitizePointers(const Context& ctx, const Variable& v) {
+    return sanitizePointers(ctx, Variable(v));
 }
@@ -7,11 +7,14 @@
 
 void printType(const Type& t);
 
-Variable sanitizePointers(Context& ctx, Variable v);
+// turns the context offsets in v's pointers into real pointers into ctx.
+// the rvalue overload does it in place, the other one on a copy
+Variable sanitizePointers(const Context& ctx, Variable&& v);
+Variable sanitizePointers(const Context& ctx, const Variable& v);
 
 template<typename T>
-T primitive(Context& ctx, Variable v, size_t index=0) {
-    v = sanitizePointers(ctx, v);
+T primitive(Context& ctx, Variable&& v, size_t index=0) {
+    v = sanitizePointers(ctx, std::move(v));
 
     if (sizeof(T) != t_sizeof(v.type)) {
         printType(v.type);
@@ -41,6 +44,11 @@ T primitive(Context& ctx, Variable v, size_t index=0) {
 //    }
 }
 
-void printVariable(Context& ctx, Variable v, bool done=true);
+template<typename T>
+T primitive(Context& ctx, const Variable& v, size_t index=0) {
+    return primitive<T>(ctx, Variable(v), index);
+}
+
+void printVariable(Context& ctx, const Variable& v, bool done=true);
 
 #endif //DTC_DYNTYPC_H
\ No newline at end of file
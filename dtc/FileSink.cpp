@@ -0,0 +1,152 @@
+#include "FileSink.h"
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+
+static std::runtime_error errno_error(const std::string& what) {
+    return std::runtime_error(what + ": " + std::strerror(errno));
+}
+
+AsyncFileSink::AsyncFileSink(const std::string &path, size_t max_queued, bool append)
+        : max_queued(std::max<size_t>(max_queued, 1)) {
+    fd = ::open(path.c_str(), O_WRONLY | O_CREAT | (append ? 0 : O_TRUNC), 0644);
+    if (fd < 0) {
+        throw errno_error("could not open " + path);
+    }
+    if (append) {
+        off_t end = ::lseek(fd, 0, SEEK_END);
+        if (end < 0) {
+            ::close(fd);
+            throw errno_error("could not seek " + path);
+        }
+        offset = uint64_t(end);
+    }
+    worker = std::thread(&AsyncFileSink::run, this);
+}
+
+AsyncFileSink::~AsyncFileSink() {
+    try {
+        close();
+    } catch (const std::exception&) {
+        // destructors can't throw, call close() directly to see the error
+    }
+}
+
+Bytes AsyncFileSink::acquire() {
+    std::lock_guard<std::mutex> lock(m);
+    if (spare.empty()) {
+        return {};
+    }
+    Bytes b = std::move(spare.back());
+    spare.pop_back();
+    return b;
+}
+
+void AsyncFileSink::write(Bytes &&bytes) {
+    std::unique_lock<std::mutex> lock(m);
+    if (stopping) {
+        throw std::runtime_error("file sink is closed");
+    }
+    cv.wait(lock, [&] { return queue.size() < max_queued || error; });
+    rethrow_locked();
+    queue.push_back(std::move(bytes));
+    cv.notify_all();
+}
+
+void AsyncFileSink::write(const Bytes &bytes) {
+    Bytes copy = acquire();
+    copy.assign(bytes.begin(), bytes.end());
+    write(std::move(copy));
+}
+
+void AsyncFileSink::flush() {
+    std::unique_lock<std::mutex> lock(m);
+    cv.wait(lock, [&] { return (queue.empty() && !busy) || error; });
+    rethrow_locked();
+}
+
+void AsyncFileSink::sync() {
+    flush();
+    if (::fsync(fd) != 0) {
+        throw errno_error("fsync failed");
+    }
+}
+
+void AsyncFileSink::close() {
+    if (!worker.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m);
+        stopping = true;
+    }
+    cv.notify_all();
+    worker.join();
+    ::close(fd);
+    fd = -1;
+    std::lock_guard<std::mutex> lock(m);
+    rethrow_locked();
+}
+
+uint64_t AsyncFileSink::written() const {
+    return offset.load();
+}
+
+void AsyncFileSink::run() {
+    std::unique_lock<std::mutex> lock(m);
+    for (;;) {
+        cv.wait(lock, [&] { return !queue.empty() || stopping; });
+        if (queue.empty()) {
+            return; // stopping, and everything queued has been written
+        }
+        Bytes b = std::move(queue.front());
+        queue.pop_front();
+        busy = true;
+        bool failed = error != nullptr;
+        cv.notify_all(); // there's room in the queue again
+        lock.unlock();
+
+        std::exception_ptr err;
+        if (!failed) {
+            try {
+                write_all(b);
+            } catch (...) {
+                err = std::current_exception();
+            }
+        }
+        b.clear();
+
+        lock.lock();
+        busy = false;
+        if (err) {
+            error = err;
+        }
+        if (spare.size() <= max_queued) {
+            spare.push_back(std::move(b));
+        }
+        cv.notify_all();
+    }
+}
+
+void AsyncFileSink::write_all(const Bytes &bytes) {
+    const std::byte* p = bytes.data();
+    size_t left = bytes.size();
+    while (left > 0) {
+        ssize_t n = ::pwrite(fd, p, left, off_t(offset.load()));
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw errno_error("write failed");
+        }
+        p += n;
+        left -= size_t(n);
+        offset += uint64_t(n);
+    }
+}
+
+void AsyncFileSink::rethrow_locked() {
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
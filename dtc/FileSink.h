@@ -0,0 +1,71 @@
+#pragma once
+#ifndef DTC_FILESINK_H
+#define DTC_FILESINK_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "Serial.h"
+
+// writes buffers to a file on a background thread, so serializing the next record overlaps with
+// writing the previous one. at most max_queued buffers wait to be written, write() blocks when
+// the queue is full (backpressure). written buffers are kept for acquire(), so a writer that
+// serializes into acquired buffers stops allocating once it reaches steady state.
+// errors from the writer thread are rethrown by the next call on the caller's thread.
+// it's for loops of records, a single write is cheaper with a plain std::ofstream. POSIX only.
+//
+//     AsyncFileSink sink("records.bin");
+//     for (auto& record : records) {
+//         // the next record is serialized while this one is written
+//         sink.write(final_serialize(record, Record_t, FRAME_DEFAULT | FRAME_SIZED));
+//     }
+//     sink.close();
+struct AsyncFileSink {
+    explicit AsyncFileSink(const std::string& path, size_t max_queued=2, bool append=false);
+    ~AsyncFileSink();
+
+    AsyncFileSink(const AsyncFileSink&) = delete;
+    AsyncFileSink& operator=(const AsyncFileSink&) = delete;
+
+    // an empty buffer, with the capacity of one that has already been written if there is one
+    Bytes acquire();
+
+    void write(Bytes&& bytes);
+    void write(const Bytes& bytes);
+
+    // waits until everything written so far is in the file
+    void flush();
+
+    // flush, then fsync so it survives a crash
+    void sync();
+
+    // flushes and stops the writer thread, called by the destructor
+    void close();
+
+    // bytes handed to the file so far
+    [[nodiscard]] uint64_t written() const;
+
+private:
+    int fd = -1;
+    size_t max_queued;
+    std::atomic<uint64_t> offset{0}; // only the writer thread moves it
+
+    mutable std::mutex m;
+    std::condition_variable cv;
+    std::deque<Bytes> queue{};
+    std::vector<Bytes> spare{};
+    bool busy = false; // the writer thread is holding a buffer
+    bool stopping = false;
+    std::exception_ptr error{};
+    std::thread worker;
+
+    void run();
+    void write_all(const Bytes& bytes);
+    void rethrow_locked();
+};
+
+#endif //DTC_FILESINK_H
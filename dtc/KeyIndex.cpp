@@ -0,0 +1,295 @@
+#include "KeyIndex.h"
+#include <cerrno>
+#include <fstream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// the tail is merged into the sorted run once it's longer than this, or than 1/16 of the run
+static const uint64_t MERGE_TAIL = 1024;
+
+static std::runtime_error errno_error(const std::string& what) {
+    return std::runtime_error(what + ": " + std::strerror(errno));
+}
+
+static void put_u64(Bytes& out, uint64_t v) {
+    for (int i = 0; i < 8; i++) {
+        out.push_back(std::byte(v >> (i * 8)));
+    }
+}
+
+static uint64_t key_mix(uint64_t h, uint64_t v) {
+    h ^= v + 0x9e3779b97f4a7c15 + (h << 6) + (h >> 2);
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9;
+    h ^= h >> 27;
+    return h;
+}
+
+KeyExtractor::KeyExtractor(const Type &t, FieldPath path) : type(t), plan(&plan_for(t)), path(std::move(path)) {
+    if (!plan->flat) {
+        throw std::runtime_error("can't index a type with unions");
+    }
+    const Type& field = t_field(type, this->path);
+    if (!field.is_basic() || field.deref_count != 0) {
+        throw std::runtime_error("key field has to be an integer");
+    }
+    auto& b = std::get<BasicType>(field.type);
+    if (b.floating || b.bytes == 0 || b.bytes > 8) {
+        throw std::runtime_error("key field has to be an integer");
+    }
+    size = b.bytes;
+    sign = b.sign;
+    offset = t_offsetof(type, this->path);
+    // every pointer slot before the field is 4 bytes shorter in a compact value
+    compact_offset = offset;
+    for (uint64_t p : plan->pointers) {
+        if (p < offset) {
+            compact_offset -= 4;
+        }
+    }
+    id = key_mix(0, plan->fingerprint);
+    for (uint64_t i : this->path) {
+        id = key_mix(id, i);
+    }
+}
+
+int64_t KeyExtractor::key(ByteSpan frame) const {
+    FrameHeader h = read_frame_header(frame);
+    bool compact = (h.flags & FRAME_COMPACT_PTR) != 0;
+    uint64_t value_size = plan->size - (compact ? 4 * plan->pointers.size() : 0);
+    const std::byte* body = frame.data() + h.header_size;
+    bool same = h.body_size == plan->header.size() + value_size;
+    if (same && (h.flags & FRAME_FINGERPRINT)) {
+        same = h.fingerprint == plan->fingerprint;
+    } else if (same) {
+        same = std::memcmp(body, plan->header.data(), plan->header.size()) == 0;
+    }
+    if (!same) {
+        throw std::runtime_error("record has a different type than the index");
+    }
+    const std::byte* p = body + plan->header.size() + (compact ? compact_offset : offset);
+    uint64_t v = 0;
+    for (uint64_t i = 0; i < size; i++) {
+        v |= uint64_t(p[i]) << (i * 8);
+    }
+    if (sign && size < 8 && (v >> (size * 8 - 1)) & 1) {
+        v |= ~uint64_t(0) << (size * 8);
+    }
+    return int64_t(v);
+}
+
+KeyIndex::KeyIndex(const KeyExtractor &key) : key_id(key.id) {}
+
+void KeyIndex::add(int64_t key, uint64_t record) {
+    entries.push_back(KeyIndexEntry{key, record});
+    if (entries.size() - sorted > std::max(MERGE_TAIL, sorted / 16)) {
+        merge();
+    }
+}
+
+void KeyIndex::merge() {
+    auto mid = entries.begin() + std::ptrdiff_t(sorted);
+    std::sort(mid, entries.end());
+    std::inplace_merge(entries.begin(), mid, entries.end());
+    sorted = entries.size();
+}
+
+std::vector<uint64_t> KeyIndex::find(int64_t key) const {
+    std::vector<uint64_t> out;
+    for (auto& e : range(key, key)) {
+        out.push_back(e.record);
+    }
+    return out;
+}
+
+std::vector<KeyIndexEntry> KeyIndex::range(int64_t lo, int64_t hi) const {
+    std::vector<KeyIndexEntry> out;
+    if (lo > hi) {
+        return out;
+    }
+    auto end = entries.begin() + std::ptrdiff_t(sorted);
+    auto first = std::lower_bound(entries.begin(), end, KeyIndexEntry{lo, 0});
+    for (auto it = first; it != end && it->key <= hi; ++it) {
+        out.push_back(*it);
+    }
+    size_t from_run = out.size();
+    for (auto it = end; it != entries.end(); ++it) {
+        if (it->key >= lo && it->key <= hi) {
+            out.push_back(*it);
+        }
+    }
+    if (out.size() != from_run) {
+        std::sort(out.begin(), out.end());
+    }
+    return out;
+}
+
+void KeyIndex::save(const std::string &path) const {
+    Bytes out;
+    out.reserve(KEYINDEX_HEADER_SIZE + entries.size() * KEYINDEX_ENTRY_SIZE);
+    put_u64(out, KEYINDEX_MAGIC);
+    put_u64(out, key_id);
+    put_u64(out, covered);
+    put_u64(out, sorted);
+    put_u64(out, entries.size());
+    for (auto& e : entries) {
+        put_u64(out, uint64_t(e.key));
+        put_u64(out, e.record);
+    }
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char*>(out.data()), std::streamsize(out.size()));
+    if (!file) {
+        throw std::runtime_error("could not write " + path);
+    }
+}
+
+// checks a KeyIndex file's header, returns its entry count
+static uint64_t check_header(const std::byte* p, uint64_t size, const KeyExtractor& key, uint64_t& sorted) {
+    if (size < KEYINDEX_HEADER_SIZE || deserialize_u64(p) != KEYINDEX_MAGIC) {
+        throw std::runtime_error("not a key index file");
+    }
+    if (deserialize_u64(p + 8) != key.id) {
+        throw std::runtime_error("the file indexes a different key");
+    }
+    sorted = deserialize_u64(p + 24);
+    uint64_t count = deserialize_u64(p + 32);
+    if (count != (size - KEYINDEX_HEADER_SIZE) / KEYINDEX_ENTRY_SIZE ||
+        (size - KEYINDEX_HEADER_SIZE) % KEYINDEX_ENTRY_SIZE != 0 || sorted > count) {
+        throw std::runtime_error("key index corrupt");
+    }
+    return count;
+}
+
+KeyIndex KeyIndex::load(const std::string &path, const KeyExtractor &key) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("could not open " + path);
+    }
+    file.seekg(0, std::ios::end);
+    Bytes raw(uint64_t(file.tellg()));
+    file.seekg(0);
+    file.read(reinterpret_cast<char*>(raw.data()), std::streamsize(raw.size()));
+    if (!file) {
+        throw std::runtime_error("could not read " + path);
+    }
+    KeyIndex index(key);
+    uint64_t count = check_header(raw.data(), raw.size(), key, index.sorted);
+    index.covered = deserialize_u64(raw.data() + 16);
+    index.entries.resize(count);
+    for (uint64_t i = 0; i < count; i++) {
+        const std::byte* p = raw.data() + KEYINDEX_HEADER_SIZE + i * KEYINDEX_ENTRY_SIZE;
+        index.entries[i] = KeyIndexEntry{int64_t(deserialize_u64(p)), deserialize_u64(p + 8)};
+    }
+    return index;
+}
+
+void update_key_index(ContainerReader &reader, KeyIndex &index, const KeyExtractor &key) {
+    if (index.key_id != key.id) {
+        throw std::runtime_error("the index is of a different key");
+    }
+    uint64_t type_id = container_type_id(key.type);
+    for (uint64_t i = index.covered; i < reader.size(); i++) {
+        if (reader.entry(i).type_id != type_id) {
+            continue;
+        }
+        index.add(key.key(reader.read(i)), i);
+    }
+    index.covered = std::max<uint64_t>(index.covered, reader.size());
+}
+
+MappedKeyIndex::MappedKeyIndex(const std::string &path, const KeyExtractor &key) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw errno_error("could not open " + path);
+    }
+    struct stat st{};
+    if (::fstat(fd, &st) != 0) {
+        auto e = errno_error("could not stat " + path);
+        ::close(fd);
+        throw e;
+    }
+    mapped = uint64_t(st.st_size);
+    if (mapped < KEYINDEX_HEADER_SIZE) {
+        ::close(fd);
+        throw std::runtime_error("not a key index file");
+    }
+    void* m = ::mmap(nullptr, mapped, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (m == MAP_FAILED) {
+        throw errno_error("could not map " + path);
+    }
+    map = static_cast<const std::byte*>(m);
+    try {
+        count = check_header(map, mapped, key, sorted);
+    } catch (...) {
+        ::munmap(m, mapped);
+        throw;
+    }
+}
+
+MappedKeyIndex::~MappedKeyIndex() {
+    ::munmap(const_cast<std::byte*>(map), mapped);
+}
+
+KeyIndexEntry MappedKeyIndex::entry(uint64_t i) const {
+    const std::byte* p = map + KEYINDEX_HEADER_SIZE + i * KEYINDEX_ENTRY_SIZE;
+    return KeyIndexEntry{int64_t(deserialize_u64(p)), deserialize_u64(p + 8)};
+}
+
+uint64_t MappedKeyIndex::lower_bound(int64_t key) const {
+    // only the entries a probe lands on are read, so a lookup touches O(log n) pages of the file
+    uint64_t lo = 0, n = sorted;
+    while (n > 0) {
+        uint64_t half = n / 2;
+        if (entry(lo + half).key < key) {
+            lo += half + 1;
+            n -= half + 1;
+        } else {
+            n = half;
+        }
+    }
+    return lo;
+}
+
+std::vector<uint64_t> MappedKeyIndex::find(int64_t key) const {
+    std::vector<uint64_t> out;
+    for (auto& e : range(key, key)) {
+        out.push_back(e.record);
+    }
+    return out;
+}
+
+std::vector<KeyIndexEntry> MappedKeyIndex::range(int64_t lo, int64_t hi) const {
+    std::vector<KeyIndexEntry> out;
+    if (lo > hi) {
+        return out;
+    }
+    for (uint64_t i = lower_bound(lo); i < sorted; i++) {
+        KeyIndexEntry e = entry(i);
+        if (e.key > hi) {
+            break;
+        }
+        out.push_back(e);
+    }
+    size_t from_run = out.size();
+    for (uint64_t i = sorted; i < count; i++) {
+        KeyIndexEntry e = entry(i);
+        if (e.key >= lo && e.key <= hi) {
+            out.push_back(e);
+        }
+    }
+    if (out.size() != from_run) {
+        std::sort(out.begin(), out.end());
+    }
+    return out;
+}
+
+uint64_t MappedKeyIndex::covered() const {
+    return deserialize_u64(map + 16);
+}
+
+uint64_t MappedKeyIndex::size() const {
+    return count;
+}
@@ -0,0 +1,124 @@
+#pragma once
+#ifndef DTC_KEYINDEX_H
+#define DTC_KEYINDEX_H
+
+#include <string>
+#include "Container.h"
+#include "Plan.h"
+
+// a secondary index over the records of a container, by one integer field.
+// keys are read straight out of each serialized record at the field's offset (the record is never
+// deserialized), and kept as a sorted run plus a short unsorted tail of the keys added since the
+// last merge, so appending is cheap and lookups are a binary search plus a scan of the tail.
+// the index is saved to its own file next to the container, MappedKeyIndex searches a saved one
+// in place without loading it.
+
+// KeyIndex file:
+//  - magic: u64 (KEYINDEX_MAGIC)
+//  - key_id: u64 (KeyExtractor::id: the record type and the key's field path)
+//  - covered: u64 (container records looked at so far)
+//  - sorted: u64, count: u64
+//  - entries: count * { key: i64, record: u64 }, the first `sorted` ordered by (key, record),
+//    the rest in the order they were added
+
+const uint64_t KEYINDEX_MAGIC = 0x584959454b435444; // "DTCKEYIX"
+const uint64_t KEYINDEX_HEADER_SIZE = 8 * 5;
+const uint64_t KEYINDEX_ENTRY_SIZE = 16;
+
+struct KeyIndexEntry {
+    int64_t key = 0;
+    uint64_t record = 0; // index in the container
+
+    bool operator<(const KeyIndexEntry& o) const {
+        return key != o.key ? key < o.key : record < o.record;
+    }
+};
+
+// reads the key of records of type t, the integer field at path (up to 8 bytes, sign extended
+// if it's signed). types with unions don't have the field at a fixed offset, so they can't be used
+struct KeyExtractor {
+    Type type{};
+    const Plan* plan = nullptr; // plan_for(type), for its header and pointer slots
+    FieldPath path{};
+    uint64_t id = 0;
+    uint64_t offset = 0; // of the field in the value
+    uint64_t compact_offset = 0; // in a FRAME_COMPACT_PTR value
+    uint64_t size = 0;
+    bool sign = false;
+
+    KeyExtractor(const Type& t, FieldPath path);
+
+    // the key of a serialized record (a frame), throws if it's not of type
+    [[nodiscard]] int64_t key(ByteSpan frame) const;
+};
+
+struct KeyIndex {
+    uint64_t key_id = 0;
+    uint64_t covered = 0;
+    uint64_t sorted = 0;
+    std::vector<KeyIndexEntry> entries{};
+
+    KeyIndex() = default;
+    explicit KeyIndex(const KeyExtractor& key);
+
+    // adds a record's key, the tail is merged into the sorted run once it gets long
+    void add(int64_t key, uint64_t record);
+
+    // sorts the tail into the sorted run
+    void merge();
+
+    // the records with this key, in record order
+    [[nodiscard]] std::vector<uint64_t> find(int64_t key) const;
+
+    // the entries with lo <= key <= hi, in key order
+    [[nodiscard]] std::vector<KeyIndexEntry> range(int64_t lo, int64_t hi) const;
+
+    void save(const std::string& path) const;
+
+    // throws if the file is an index of another key (key_id)
+    static KeyIndex load(const std::string& path, const KeyExtractor& key);
+};
+
+// indexes the records of the container added since the index was last updated (index.covered),
+// only records of the extractor's type are added
+void update_key_index(ContainerReader& reader, KeyIndex& index, const KeyExtractor& key);
+
+// appends val to the container and its key to the index
+template<typename T>
+size_t append_indexed(ContainerWriter& writer, KeyIndex& index, const KeyExtractor& key, const T& val,
+                      uint8_t flags=FRAME_DEFAULT) {
+    if (index.covered != writer.entries.size()) {
+        throw std::runtime_error("the index is behind the container, update it first");
+    }
+    Bytes frame = final_serialize(val, key.type, flags | FRAME_SIZED);
+    size_t i = writer.append_frame(frame, container_type_id(key.type));
+    index.add(key.key(frame), i);
+    index.covered = i + 1;
+    return i;
+}
+
+// a saved KeyIndex mapped read-only, lookups read the file in place
+struct MappedKeyIndex {
+    explicit MappedKeyIndex(const std::string& path, const KeyExtractor& key);
+    ~MappedKeyIndex();
+
+    MappedKeyIndex(const MappedKeyIndex&) = delete;
+    MappedKeyIndex& operator=(const MappedKeyIndex&) = delete;
+
+    [[nodiscard]] std::vector<uint64_t> find(int64_t key) const;
+    [[nodiscard]] std::vector<KeyIndexEntry> range(int64_t lo, int64_t hi) const;
+
+    [[nodiscard]] uint64_t covered() const;
+    [[nodiscard]] uint64_t size() const;
+
+private:
+    const std::byte* map = nullptr;
+    uint64_t mapped = 0;
+    uint64_t sorted = 0;
+    uint64_t count = 0;
+
+    [[nodiscard]] KeyIndexEntry entry(uint64_t i) const;
+    [[nodiscard]] uint64_t lower_bound(int64_t key) const;
+};
+
+#endif //DTC_KEYINDEX_H
@@ -0,0 +1,189 @@
+#include "Layout.h"
+#include <numeric>
+#include <unordered_map>
+
+static void store_u64(std::byte* p, uint64_t v) {
+    for (int i = 0; i < 8; i++) {
+        p[i] = std::byte(v >> (i * 8));
+    }
+}
+
+// the alignment a value of type t would have unpacked (its largest scalar, up to 8)
+static uint64_t natural_align(const Type& t) {
+    if (t.deref_count > 0 || t.is_slice()) {
+        return 8;
+    }
+    if (auto b = std::get_if<BasicType>(&t.type)) {
+        return b->bytes == 2 || b->bytes == 4 || b->bytes == 8 ? b->bytes : 1;
+    }
+    uint64_t align = 1;
+    if (auto s = std::get_if<StructType>(&t.type)) {
+        for (auto& field : s->types) {
+            align = std::max(align, natural_align(field));
+        }
+    } else if (auto a = std::get_if<ArrayType>(&t.type)) {
+        align = natural_align(a->elem());
+    } else if (auto u = std::get_if<UnionType>(&t.type)) {
+        align = 4; // the tag
+        for (auto& member : u->types) {
+            align = std::max(align, natural_align(member));
+        }
+    }
+    return align;
+}
+
+namespace {
+
+struct SlotInfo {
+    uint64_t depth = 0; // in the type tree
+    uint64_t align = 1; // of the pointee
+};
+
+} // namespace
+
+// in t_pointer_offsets order
+static void slot_infos(const Type& t, uint64_t depth, std::vector<SlotInfo>& out) {
+    if (t.deref_count > 0) {
+        out.push_back(SlotInfo{depth, natural_align(t.deref())});
+    } else if (auto sl = std::get_if<SliceType>(&t.type)) {
+        out.push_back(SlotInfo{depth, natural_align(sl->elem())});
+    } else if (auto s = std::get_if<StructType>(&t.type)) {
+        for (auto& field : s->types) {
+            slot_infos(field, depth + 1, out);
+        }
+    } else if (auto a = std::get_if<ArrayType>(&t.type)) {
+        if (t_has_pointers(a->elem())) {
+            for (uint64_t i = 0; i < a->count; i++) {
+                slot_infos(a->elem(), depth + 1, out);
+            }
+        }
+    }
+}
+
+void ContextLayout::weigh(const Type &t, const FieldPath &path, uint64_t weight) {
+    uint64_t offset = t_offsetof(t, path);
+    std::vector<uint64_t> pointers = t_pointer_offsets(t);
+    auto it = std::find(pointers.begin(), pointers.end(), offset);
+    const Type& field = t_field(t, path);
+    if (it == pointers.end() || !(field.deref_count > 0 || field.is_slice())) {
+        throw std::runtime_error("field is not a pointer");
+    }
+    auto slot = size_t(it - pointers.begin());
+    if (weights.size() <= slot) {
+        weights.resize(slot + 1);
+    }
+    weights[slot] = weight;
+}
+
+namespace {
+
+// the pointee of a slot: where it is in the context and how many bytes it takes
+struct Block {
+    uint64_t offset = 0;
+    uint64_t size = 0;
+};
+
+} // namespace
+
+static Block slot_block(const PlanOp& op, const std::byte* value, const Context& ctx) {
+    Block b;
+    b.offset = deserialize_u64(value + op.offset);
+    if (b.offset > ctx.size()) {
+        throw std::runtime_error("pointer is past the end of the context");
+    }
+    uint64_t room = ctx.size() - b.offset;
+    if (op.kind == PlanOp::Pointer) {
+        b.size = op.size;
+    } else if (op.kind == PlanOp::CString) {
+        auto* s = reinterpret_cast<const char*>(ctx.data() + b.offset);
+        b.size = strnlen(s, room) + 1;
+    } else {
+        uint64_t count = deserialize_u64(value + op.offset + sizeof(void*));
+        if (op.size != 0 && count > room / op.size) {
+            throw std::runtime_error("slice is past the end of the context");
+        }
+        b.size = count * op.size + (op.string ? 1 : 0);
+    }
+    if (b.size > room) {
+        throw std::runtime_error("pointee is past the end of the context");
+    }
+    return b;
+}
+
+void layout_context(const Plan &plan, std::byte *value, Context &ctx, const ContextLayout &layout,
+                    uint64_t ctx_start) {
+    if (!plan.flat) {
+        throw std::runtime_error("a type with unions has no fixed layout to lay out");
+    }
+    std::vector<const PlanOp*> slots;
+    for (const PlanOp& op : plan.ops) {
+        if (op.kind != PlanOp::Copy) {
+            slots.push_back(&op);
+        }
+    }
+
+    std::vector<SlotInfo> infos;
+    slot_infos(plan.type, 0, infos);
+    std::vector<size_t> order(slots.size());
+    std::iota(order.begin(), order.end(), 0);
+    if (layout.order == ContextLayout::BreadthFirst) {
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return infos[a].depth < infos[b].depth; });
+    } else if (layout.order == ContextLayout::ByWeight) {
+        auto weight = [&](size_t i) { return i < layout.weights.size() ? layout.weights[i] : 0; };
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return weight(a) > weight(b); });
+    }
+
+    // interned strings are one block for several slots, it goes where the first of them puts it.
+    // only the exact same non-empty block is shared: an empty one has the offset of whatever
+    // pointee comes after it, and must not drag that pointee's slot along with it
+    std::unordered_map<uint64_t, Block> moved; // old offset -> new block
+    Context out;
+    out.reserve(ctx.size());
+    uint64_t line = layout.line > 1 ? layout.line : 1;
+    for (size_t i : order) {
+        Block b = slot_block(*slots[i], value, ctx);
+        auto it = ctx.intern_strings && b.size > 0 ? moved.find(b.offset) : moved.end();
+        uint64_t to;
+        if (it != moved.end() && it->second.size == b.size) {
+            to = it->second.offset;
+        } else {
+            if (line > 1) {
+                // the pointee's own alignment first, then the line it falls in
+                uint64_t align = infos[i].align;
+                out.resize(out.size() + (align - (ctx_start + out.size()) % align) % align);
+                uint64_t at = (ctx_start + out.size()) % line;
+                if (at != 0 && (b.size >= line || at + b.size > line)) {
+                    out.resize(out.size() + line - at);
+                }
+            }
+            to = out.size();
+            out.insert(out.end(), ctx.begin() + std::ptrdiff_t(b.offset), ctx.begin() + std::ptrdiff_t(b.offset + b.size));
+            if (b.size > 0) {
+                moved.emplace(b.offset, Block{to, b.size});
+            }
+        }
+        store_u64(value + slots[i]->offset, to);
+    }
+    out.intern_strings = ctx.intern_strings;
+    ctx = std::move(out);
+}
+
+Bytes serialize_frame(const void *val, const Type &t, uint8_t flags, const ContextLayout &layout) {
+    const Plan& plan = plan_for(t);
+    Context ctx;
+    ctx.intern_strings = (flags & FRAME_INTERNED) != 0;
+    Bytes body;
+    plan_encode(plan, val, ctx, body);
+    uint64_t header = plan.header.size();
+    bool compact = (flags & FRAME_COMPACT_PTR) && !plan.pointers.empty();
+    uint64_t value_size = compact ? plan.size - plan.pointers.size() * 4 : plan.size;
+    layout_context(plan, body.data() + header, ctx, layout, frame_header_size(flags) + header + value_size);
+    if (flags & FRAME_COMPACT_PTR) {
+        if (!compact || ctx.size() > UINT32_MAX) {
+            flags &= uint8_t(~FRAME_COMPACT_PTR);
+        } else {
+            body.resize(header + compact_pointers(body.data() + header, plan.size, plan.pointers));
+        }
+    }
+    return write_frame(body, ctx, flags, plan.fingerprint);
+}
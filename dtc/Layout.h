@@ -0,0 +1,55 @@
+#pragma once
+#ifndef DTC_LAYOUT_H
+#define DTC_LAYOUT_H
+
+#include "Plan.h"
+
+// choosing where pointees go in the context, for reading the record after it's loaded.
+// encoding puts each pointee at the end of the context when its slot is reached, so they end up
+// in field order with no regard for cache lines: a small string can straddle two lines, and the
+// pointee that's read first can be the last one in the context.
+// a layout pass moves the pointees (blocks) of an encoded value around and rewrites its pointer
+// slots to match:
+//  - DepthFirst: field order, the order encoding uses (a field's pointees right after each other)
+//  - BreadthFirst: pointees of top level fields first, then of the fields of nested structs and
+//    arrays, a level at a time
+//  - ByWeight: the heaviest first (weights from counting how often each pointer is followed),
+//    ties in field order
+// and with a line size, each block is aligned like its type would be, never straddles a line, and
+// a block of a line or more starts on one.
+// lines are counted from the start of the frame, so they're real cache lines wherever the frame
+// is read in place from an aligned address (a mapped file, a ring, an aligned buffer).
+
+struct ContextLayout {
+    enum Order : uint8_t {
+        DepthFirst,
+        BreadthFirst,
+        ByWeight,
+    };
+    Order order = DepthFirst;
+    uint64_t line = 64; // 0 or 1 packs the blocks without any padding
+    std::vector<uint64_t> weights{}; // for ByWeight, one per pointer slot (t_pointer_offsets order)
+
+    // sets the weight of the pointer or slice at path in a value of type t
+    void weigh(const Type& t, const FieldPath& path, uint64_t weight);
+};
+
+// lays out the context of an encoded value (t_sizeof bytes, pointer slots holding u64 context
+// offsets) of the plan's type. ctx_start is where the context will be, counted from where lines
+// are. interned strings stay shared, and the intern map is cleared (its offsets are stale).
+// types with unions don't have their pointers at fixed offsets, so they can't be laid out
+void layout_context(const Plan& plan, std::byte* value, Context& ctx, const ContextLayout& layout,
+                    uint64_t ctx_start=0);
+
+// serialize_frame with the context laid out
+Bytes serialize_frame(const void* val, const Type& t, uint8_t flags, const ContextLayout& layout);
+
+template<typename T>
+Bytes final_serialize(const T& val, const Type& t, const ContextLayout& layout, uint8_t flags=FRAME_DEFAULT) {
+    if (sizeof(T) != t_sizeof(t)) {
+        throw std::runtime_error("primitive type size mismatch");
+    }
+    return serialize_frame(&val, t, flags, layout);
+}
+
+#endif //DTC_LAYOUT_H
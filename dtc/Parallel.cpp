@@ -0,0 +1,112 @@
+#include "Parallel.h"
+#include <algorithm>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+size_t worker_count(size_t threads) {
+    if (threads == 0) {
+        threads = std::thread::hardware_concurrency();
+    }
+    return std::max<size_t>(threads, 1);
+}
+
+void parallel_for(size_t n, size_t threads, const std::function<void(size_t, size_t, size_t)>& fn) {
+    size_t workers = std::min(worker_count(threads), std::max<size_t>(n, 1));
+    if (workers == 1) {
+        fn(0, n, 0);
+        return;
+    }
+    std::vector<std::exception_ptr> errors(workers);
+    std::vector<std::thread> pool;
+    pool.reserve(workers - 1);
+    auto run = [&](size_t w) {
+        size_t begin = n * w / workers;
+        size_t end = n * (w + 1) / workers;
+        try {
+            fn(begin, end, w);
+        } catch (...) {
+            errors[w] = std::current_exception();
+        }
+    };
+    for (size_t w = 1; w < workers; w++) {
+        pool.emplace_back(run, w);
+    }
+    run(0); // the calling thread takes the first range
+    for (auto& th : pool) {
+        th.join();
+    }
+    for (auto& e : errors) {
+        if (e) {
+            std::rethrow_exception(e);
+        }
+    }
+}
+
+namespace {
+
+struct TaskQueue {
+    std::mutex m;
+    std::deque<size_t> tasks;
+
+    bool pop_front(size_t& task) {
+        std::lock_guard<std::mutex> lock(m);
+        if (tasks.empty()) {
+            return false;
+        }
+        task = tasks.front();
+        tasks.pop_front();
+        return true;
+    }
+
+    bool steal_back(size_t& task) {
+        std::lock_guard<std::mutex> lock(m);
+        if (tasks.empty()) {
+            return false;
+        }
+        task = tasks.back();
+        tasks.pop_back();
+        return true;
+    }
+};
+
+} // namespace
+
+void parallel_for_stealing(size_t n, size_t threads, const std::function<void(size_t, size_t)>& fn) {
+    size_t workers = std::min(worker_count(threads), std::max<size_t>(n, 1));
+    if (workers == 1) {
+        for (size_t i = 0; i < n; i++) {
+            fn(i, 0);
+        }
+        return;
+    }
+    std::vector<std::unique_ptr<TaskQueue>> queues;
+    queues.reserve(workers);
+    for (size_t w = 0; w < workers; w++) {
+        queues.push_back(std::make_unique<TaskQueue>());
+        for (size_t i = n * w / workers; i < n * (w + 1) / workers; i++) {
+            queues[w]->tasks.push_back(i);
+        }
+    }
+    // parallel_for gives every worker its own thread, the queues decide what they actually run
+    parallel_for(workers, workers, [&](size_t, size_t, size_t w) {
+        size_t task;
+        for (;;) {
+            if (queues[w]->pop_front(task)) {
+                fn(task, w);
+                continue;
+            }
+            bool stole = false;
+            for (size_t k = 1; k < workers && !stole; k++) {
+                stole = queues[(w + k) % workers]->steal_back(task);
+            }
+            if (!stole) {
+                return; // nothing is ever added back, so empty everywhere means done
+            }
+            fn(task, w);
+        }
+    });
+}
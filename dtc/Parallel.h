@@ -0,0 +1,20 @@
+#pragma once
+#ifndef DTC_PARALLEL_H
+#define DTC_PARALLEL_H
+
+#include <cstddef>
+#include <functional>
+
+// 0 means one worker per hardware thread
+size_t worker_count(size_t threads);
+
+// splits [0, n) into one contiguous range per worker and runs fn(begin, end, worker) on each,
+// returns once every range is done. exceptions from workers are rethrown on the calling thread
+void parallel_for(size_t n, size_t threads, const std::function<void(size_t, size_t, size_t)>& fn);
+
+// runs fn(task, worker) for every task in [0, n). each worker starts with a contiguous block of
+// tasks and takes them from the front, a worker that runs out steals from the back of another
+// worker's block, so uneven tasks don't leave threads idle. exceptions are rethrown like parallel_for
+void parallel_for_stealing(size_t n, size_t threads, const std::function<void(size_t, size_t)>& fn);
+
+#endif //DTC_PARALLEL_H
@@ -0,0 +1,108 @@
+#include "Patch.h"
+
+static void store_u64(std::byte* p, uint64_t v) {
+    for (int i = 0; i < 8; i++) {
+        p[i] = std::byte(v >> (i * 8));
+    }
+}
+
+// the field at path, and the frame's header
+static View locate(ByteSpan frame, const TypeLayout& layout, const FieldPath& path, FrameHeader& h) {
+    h = read_frame_header(frame);
+    return open_view(frame, layout).field(path);
+}
+
+// after the byte at offset changed, recomputes the checksum of the section it's in and rewrites the header
+static void rewrite_header(std::byte* frame, FrameHeader& h, uint64_t offset) {
+    if (h.flags & FRAME_CHECKSUM) {
+        const std::byte* body = frame + h.header_size;
+        if (offset < h.header_size + h.body_size) {
+            h.body_crc = crc32c(0, body, h.body_size);
+        } else {
+            h.ctx_crc = crc32c(0, body + h.body_size, h.ctx_size);
+        }
+    }
+    put_frame_header(frame, h);
+}
+
+void patch_value(std::byte *frame, size_t frame_size, const TypeLayout &layout, const FieldPath &path,
+                 const void *val, uint64_t size) {
+    FrameHeader h;
+    View f = locate(ByteSpan(frame, frame_size), layout, path, h);
+    if (size != f.layout->size) {
+        throw std::runtime_error("patch size mismatch");
+    }
+    if (!t_pointer_offsets(f.layout->type).empty()) {
+        throw std::runtime_error("field has pointers, patch its pointees instead");
+    }
+    auto offset = uint64_t(f.data - frame);
+    if (size > 0) {
+        std::memcpy(frame + offset, val, size);
+    }
+    rewrite_header(frame, h, offset);
+}
+
+void patch_pointee(Bytes &frame, const TypeLayout &layout, const FieldPath &path, const void *data, uint64_t size) {
+    FrameHeader h;
+    View f = locate(frame, layout, path, h);
+    const TypeLayout& l = *f.layout;
+    if (!l.pointee || (l.type.is_array() && l.type.deref_count == 0)) {
+        throw std::runtime_error("field is not a pointer");
+    }
+    const TypeLayout& p = *l.pointee;
+    if (!t_pointer_offsets(p.type).empty()) {
+        throw std::runtime_error("can't patch a pointee with pointers in it");
+    }
+    uint64_t count = 0;
+    if (l.slice) {
+        if (p.size == 0 || size % p.size != 0) {
+            throw std::runtime_error("patch size mismatch");
+        }
+        count = size / p.size;
+    } else if (!l.string && size != p.size) {
+        throw std::runtime_error("patch size mismatch");
+    }
+    uint64_t total = size + (l.string ? 1 : 0); // with the terminator
+
+    uint64_t old_size;
+    if (l.slice) {
+        (void)f.deref(); // checks the old slice is inside the context
+        old_size = f.count() * p.size + (l.string ? 1 : 0);
+    } else if (l.string) {
+        old_size = std::strlen(f.str()) + 1;
+    } else {
+        old_size = p.size;
+        (void)f.deref();
+    }
+
+    auto slot = uint64_t(f.data - frame.data());
+    uint64_t ctx_start = h.header_size + h.body_size;
+    if (old_size == total && !(h.flags & FRAME_INTERNED)) {
+        // same size, the pointer (and a slice's count) stays the same
+        uint64_t at = ctx_start + deserialize_u64(f.data);
+        if (size > 0) {
+            std::memcpy(frame.data() + at, data, size);
+        }
+        rewrite_header(frame.data(), h, at);
+        return;
+    }
+
+    if (frame.size() != h.frame_size()) {
+        throw std::runtime_error("the context has to be at the end of the frame to grow it");
+    }
+    uint64_t ptr = h.ctx_size;
+    auto* b = static_cast<const std::byte*>(data);
+    frame.insert(frame.end(), b, b + size);
+    if (l.string) {
+        frame.push_back(std::byte(0));
+    }
+    h.ctx_size += total;
+    if (h.flags & FRAME_CHECKSUM) {
+        h.ctx_crc = crc32c(h.ctx_crc, frame.data() + ctx_start + ptr, total);
+    }
+    store_u64(frame.data() + slot, ptr);
+    if (l.slice) {
+        store_u64(frame.data() + slot + sizeof(void*), count);
+    }
+    rewrite_header(frame.data(), h, slot);
+}
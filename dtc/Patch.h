@@ -0,0 +1,48 @@
+#pragma once
+#ifndef DTC_PATCH_H
+#define DTC_PATCH_H
+
+#include "View.h"
+
+// changing a field of a serialized record without deserializing and serializing it again.
+// fields are found the same way a View finds them (offsets from the TypeLayout), and their bytes
+// are overwritten right in the frame, so a fixed size field can be patched inside a file mapping.
+// a pointee that changes size (a longer string, a slice with more elements) doesn't fit where
+// the old one was, it's appended to the end of the context and the pointer moved to it. the old
+// pointee stays in the context as garbage until the record is serialized again.
+// the frame's checksums and context size are kept up to date.
+
+// overwrites the field at path with size bytes from val. the field can't have pointers in it
+// (they'd be real pointers, not context offsets), patch those with patch_pointee
+void patch_value(std::byte* frame, size_t frame_size, const TypeLayout& layout, const FieldPath& path,
+                 const void* val, uint64_t size);
+
+template<typename T>
+void patch_field(std::byte* frame, size_t frame_size, const TypeLayout& layout, const FieldPath& path, const T& val) {
+    patch_value(frame, frame_size, layout, path, &val, sizeof(T));
+}
+
+template<typename T>
+void patch_field(Bytes& frame, const TypeLayout& layout, const FieldPath& path, const T& val) {
+    patch_value(frame.data(), frame.size(), layout, path, &val, sizeof(T));
+}
+
+// replaces what the pointer or slice at path points to with size bytes from data:
+//  - pointer: exactly one pointee
+//  - string pointer or string slice: the characters, without the terminator (it's added)
+//  - slice: whole elements, the slice's count becomes size / element size
+// if the new pointee is the same size as the old one it's overwritten in place (unless the frame
+// has interned strings, the old one may be shared), otherwise it's appended to the context,
+// which has to be at the end of frame
+void patch_pointee(Bytes& frame, const TypeLayout& layout, const FieldPath& path, const void* data, uint64_t size);
+
+inline void patch_string(Bytes& frame, const TypeLayout& layout, const FieldPath& path, const char* str) {
+    patch_pointee(frame, layout, path, str, std::strlen(str));
+}
+
+template<typename T>
+void patch_slice(Bytes& frame, const TypeLayout& layout, const FieldPath& path, const T* elems, uint64_t count) {
+    patch_pointee(frame, layout, path, elems, count * sizeof(T));
+}
+
+#endif //DTC_PATCH_H
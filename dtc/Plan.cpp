@@ -0,0 +1,262 @@
+#include "Plan.h"
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+
+static bool is_string_pointee(const Type& t) {
+    auto b = std::get_if<BasicType>(&t.type);
+    return t.deref_count == 0 && b && b->bytes == 1 && !b->sign;
+}
+
+static void emit(std::vector<PlanOp>& ops, PlanOp op) {
+    if (op.kind == PlanOp::Copy) {
+        if (op.size == 0) {
+            return;
+        }
+        if (!ops.empty() && ops.back().kind == PlanOp::Copy && ops.back().offset + ops.back().size == op.offset) {
+            ops.back().size += op.size;
+            return;
+        }
+    }
+    ops.push_back(op);
+}
+
+// same order as Variable(Context&, ...) visits the value, so pointees land in the context in the same order
+static void compile(const Type& t, uint64_t offset, std::vector<PlanOp>& ops) {
+    PlanOp op;
+    op.offset = offset;
+    if (t.deref_count > 0) {
+        Type pointee = t.deref();
+        op.kind = is_string_pointee(pointee) ? PlanOp::CString : PlanOp::Pointer;
+        op.size = t_sizeof(pointee);
+        emit(ops, op);
+    } else if (auto sl = std::get_if<SliceType>(&t.type)) {
+        op.kind = PlanOp::Slice;
+        op.size = t_sizeof(sl->elem());
+        op.string = sl->string;
+        emit(ops, op);
+    } else if (auto s = std::get_if<StructType>(&t.type)) {
+        for (auto& field : s->types) {
+            compile(field, offset, ops);
+            offset += t_sizeof(field);
+        }
+    } else if (auto a = std::get_if<ArrayType>(&t.type)) {
+        uint64_t size = t_sizeof(a->elem());
+        if (!t_has_pointers(a->elem())) {
+            op.size = size * a->count;
+            emit(ops, op);
+            return;
+        }
+        for (uint64_t i = 0; i < a->count; i++) {
+            compile(a->elem(), offset + i * size, ops);
+        }
+    } else {
+        op.size = t_sizeof(t);
+        emit(ops, op);
+    }
+}
+
+Plan::Plan(const Type &t) : type(t), fingerprint(t.fingerprint()), size(t_sizeof(t)), header(serialize_type(t)),
+                            flat(!t_has_union(t)) {
+    if (flat) {
+        pointers = t_pointer_offsets(t);
+        compile(t, 0, ops);
+    }
+}
+
+using PlanCache = std::multimap<uint64_t, std::unique_ptr<const Plan>>;
+
+// the plan in the cache for t. a fingerprint is only a hash, so the type is compared as well
+static const Plan* find_plan(const PlanCache& plans, uint64_t fp, const Type& t) {
+    auto range = plans.equal_range(fp);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (it->second->type == t) {
+            return it->second.get();
+        }
+    }
+    return nullptr;
+}
+
+const Plan &plan_for(const Type &t) {
+    static std::shared_mutex m;
+    static PlanCache plans;
+    uint64_t fp = t.fingerprint();
+    {
+        std::shared_lock<std::shared_mutex> lock(m);
+        if (const Plan* plan = find_plan(plans, fp, t)) {
+            return *plan;
+        }
+    }
+    // compiled outside the lock, if two threads race for the same type one of the plans is dropped
+    auto plan = std::make_unique<const Plan>(t);
+    std::unique_lock<std::shared_mutex> lock(m);
+    if (const Plan* cached = find_plan(plans, fp, t)) {
+        return *cached;
+    }
+    return *plans.emplace(fp, std::move(plan))->second;
+}
+
+static void store_u64(std::byte* p, uint64_t v) {
+    for (int i = 0; i < 8; i++) {
+        p[i] = std::byte(v >> (i * 8));
+    }
+}
+
+void plan_encode(const Plan &plan, const void *val, Context &ctx, Bytes &body) {
+    if (!plan.flat) {
+        auto* src = static_cast<const std::byte*>(val);
+        Variable v(ctx, plan.type, Bytes(src, src + plan.size));
+        body.insert(body.end(), plan.header.begin(), plan.header.end());
+        write_value(body, plan.type, v.data.data());
+        return;
+    }
+    size_t base = body.size();
+    body.resize(base + plan.header.size() + plan.size);
+    std::copy(plan.header.begin(), plan.header.end(), body.begin() + std::ptrdiff_t(base));
+    std::byte* dst = body.data() + base + plan.header.size();
+    auto* src = static_cast<const std::byte*>(val);
+
+    for (const PlanOp& op : plan.ops) {
+        if (op.kind == PlanOp::Copy) {
+            std::memcpy(dst + op.offset, src + op.offset, op.size);
+            continue;
+        }
+        const void* p = nullptr;
+        std::memcpy(&p, src + op.offset, sizeof(void*));
+        uint64_t index;
+        if (op.kind == PlanOp::Pointer) {
+            if (p == nullptr && op.size > 0) {
+                throw std::runtime_error("cannot serialize a null pointer");
+            }
+            index = ctx.append(p, op.size);
+        } else if (op.kind == PlanOp::CString) {
+            if (p == nullptr) {
+                throw std::runtime_error("cannot serialize a null pointer");
+            }
+            uint64_t size = std::strlen(static_cast<const char*>(p)) + 1;
+            index = ctx.intern_strings ? ctx.intern(p, size) : ctx.append(p, size);
+        } else {
+            uint64_t count = deserialize_u64(src + op.offset + sizeof(void*));
+            uint64_t size = op.size * count;
+            if (p == nullptr && size > 0) {
+                throw std::runtime_error("cannot serialize a null pointer");
+            }
+            if (op.string && ctx.intern_strings) {
+                Bytes text(size + 1);
+                if (size > 0) {
+                    std::memcpy(text.data(), p, size);
+                }
+                index = ctx.intern(text.data(), text.size());
+            } else {
+                index = ctx.append(p, size);
+                if (op.string) {
+                    ctx.push_back(std::byte(0));
+                }
+            }
+            store_u64(dst + op.offset + sizeof(void*), count);
+        }
+        store_u64(dst + op.offset, index);
+    }
+}
+
+// bytes op's pointee takes in the context, p is the pointer in the value
+static uint64_t pointee_size(const PlanOp& op, const void* p, const std::byte* slot) {
+    uint64_t size;
+    if (op.kind == PlanOp::Pointer) {
+        size = op.size;
+    } else if (op.kind == PlanOp::CString) {
+        size = p == nullptr ? 0 : std::strlen(static_cast<const char*>(p)) + 1;
+    } else {
+        size = op.size * deserialize_u64(slot + sizeof(void*));
+    }
+    if (p == nullptr && size > 0) {
+        throw std::runtime_error("cannot serialize a null pointer");
+    }
+    return size + (op.kind == PlanOp::Slice && op.string ? 1 : 0); // string slices are terminated in the context
+}
+
+uint64_t plan_context_size(const Plan &plan, const void *val) {
+    if (!plan.flat) {
+        throw std::runtime_error("a type with unions has no fixed layout to encode into");
+    }
+    auto* src = static_cast<const std::byte*>(val);
+    uint64_t size = 0;
+    for (const PlanOp& op : plan.ops) {
+        if (op.kind != PlanOp::Copy) {
+            const void* p = nullptr;
+            std::memcpy(&p, src + op.offset, sizeof(void*));
+            size += pointee_size(op, p, src + op.offset);
+        }
+    }
+    return size;
+}
+
+void plan_encode_to(const Plan &plan, const void *val, std::byte *body, std::byte *ctx) {
+    if (!plan.flat) {
+        throw std::runtime_error("a type with unions has no fixed layout to encode into");
+    }
+    std::copy(plan.header.begin(), plan.header.end(), body);
+    std::byte* dst = body + plan.header.size();
+    auto* src = static_cast<const std::byte*>(val);
+    uint64_t index = 0;
+    for (const PlanOp& op : plan.ops) {
+        if (op.kind == PlanOp::Copy) {
+            std::memcpy(dst + op.offset, src + op.offset, op.size);
+            continue;
+        }
+        const void* p = nullptr;
+        std::memcpy(&p, src + op.offset, sizeof(void*));
+        uint64_t size = pointee_size(op, p, src + op.offset);
+        if (op.kind == PlanOp::Slice) {
+            std::memcpy(dst + op.offset + sizeof(void*), src + op.offset + sizeof(void*), 8);
+            if (op.string) {
+                ctx[index + size - 1] = std::byte(0);
+            }
+        }
+        uint64_t copy = op.kind == PlanOp::Slice && op.string ? size - 1 : size;
+        if (copy > 0) {
+            std::memcpy(ctx + index, p, copy);
+        }
+        store_u64(dst + op.offset, index);
+        index += size;
+    }
+}
+
+void plan_decode(const Plan &plan, ByteSpan body, const Context &ctx, void *out, uint64_t fingerprint, bool compact) {
+    if (!plan.flat) {
+        ByteStream stream(body);
+        Variable v = sanitizePointers(ctx, deserialize_variable(stream, plan.type, fingerprint));
+        std::memcpy(out, v.data.data(), plan.size);
+        return;
+    }
+    if (fingerprint != 0) {
+        if (fingerprint != plan.fingerprint) {
+            throw std::runtime_error("schema fingerprint mismatch");
+        }
+    } else if (body.size() < plan.header.size() ||
+               !std::equal(plan.header.begin(), plan.header.end(), body.begin())) {
+        throw std::runtime_error("schema fingerprint mismatch");
+    }
+    uint64_t size = compact ? plan.size - plan.pointers.size() * 4 : plan.size;
+    if (body.size() < plan.header.size() || body.size() - plan.header.size() < size) {
+        throw std::runtime_error("value is past the end of the data");
+    }
+    auto* dst = static_cast<std::byte*>(out);
+    if (compact) {
+        widen_pointers(body.data() + plan.header.size(), dst, plan.size, plan.pointers);
+    } else {
+        std::memcpy(dst, body.data() + plan.header.size(), plan.size);
+    }
+    for (const PlanOp& op : plan.ops) {
+        if (op.kind == PlanOp::Copy) {
+            continue;
+        }
+        uint64_t ptr = deserialize_u64(dst + op.offset);
+        if (ptr > ctx.size()) {
+            throw std::runtime_error("pointer outside the context");
+        }
+        const std::byte* real = ctx.data() + ptr;
+        std::memcpy(dst + op.offset, &real, sizeof(void*));
+    }
+}
@@ -0,0 +1,63 @@
+#pragma once
+#ifndef DTC_PLAN_H
+#define DTC_PLAN_H
+
+#include "Serial.h"
+
+// a Type compiled into a flat list of instructions, so encoding and decoding a value is one loop
+// over the list instead of a walk of the type tree that builds a Variable per node.
+// the output is the same as the Variable path (serialize / deserialize), byte for byte.
+// plans are built once per type and cached (plan_for), they're immutable so threads can share them.
+// a type with unions has no fixed layout on the wire, its plan isn't flat and encodes and decodes
+// through the Variable path instead
+
+struct PlanOp {
+    enum Kind : uint8_t {
+        Copy, // size bytes of the value, as they are
+        Pointer, // a pointer whose pointee (size bytes) is copied into the context
+        CString, // a pointer to a null-terminated string, copied (or interned) with its terminator
+        Slice, // a slice of elements of size bytes each (string: a string slice)
+    };
+    Kind kind = Copy;
+    bool string = false;
+    uint64_t offset = 0; // in the value
+    uint64_t size = 0;
+};
+
+struct Plan {
+    Type type{};
+    uint64_t fingerprint = 0;
+    uint64_t size = 0; // t_sizeof(type)
+    Bytes header{}; // serialize_type(type)
+    std::vector<PlanOp> ops{}; // in offset order, adjacent copies merged
+    std::vector<uint64_t> pointers{}; // t_pointer_offsets(type)
+    bool flat = true; // false if the type has unions, then ops and pointers are empty
+
+    Plan() = default;
+    explicit Plan(const Type& t);
+};
+
+// the cached plan for t, built the first time it's asked for. plans are found by fingerprint and
+// then compared with ==, so two types with the same fingerprint never share a plan.
+// plans are never freed, and the reference stays valid for the life of the program
+const Plan& plan_for(const Type& t);
+
+// appends the serialized value at val (serialize(ctx, val, t) for the plan's type) to body,
+// putting its pointees into ctx
+void plan_encode(const Plan& plan, const void* val, Context& ctx, Bytes& body);
+
+// the size of the context plan_encode would make for val, if strings aren't interned.
+// this and plan_encode_to only work on flat plans
+uint64_t plan_context_size(const Plan& plan, const void* val);
+
+// plan_encode into memory that's already there: the serialized value (plan.header.size() + plan.size
+// bytes) goes to body and its pointees to ctx (plan_context_size bytes). strings aren't interned
+void plan_encode_to(const Plan& plan, const void* val, std::byte* body, std::byte* ctx);
+
+// decodes a serialized value of the plan's type (a frame body) into out, with its pointers into ctx.
+// with a fingerprint from the frame header the type header is skipped instead of compared.
+// compact is for the body of a FRAME_COMPACT_PTR frame
+void plan_decode(const Plan& plan, ByteSpan body, const Context& ctx, void* out, uint64_t fingerprint=0,
+                 bool compact=false);
+
+#endif //DTC_PLAN_H
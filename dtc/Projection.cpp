@@ -0,0 +1,99 @@
+#include "Projection.h"
+#include "Visit.h"
+
+// a value with unions isn't at its in-memory offsets, so it's read whole and the field copied out of it
+static Variable read_union_field(ByteStream& bytes, size_t data_start, const Type& t, const FieldPath& path) {
+    Bytes value(t_sizeof(t));
+    bytes.pos = data_start;
+    read_value(bytes, t, value.data());
+    Variable v;
+    v.type = t_field(t, path);
+    auto begin = value.begin() + std::ptrdiff_t(t_offsetof(t, path));
+    v.data.assign(begin, begin + std::ptrdiff_t(t_sizeof(v.type)));
+    return v;
+}
+
+static Variable read_field(ByteStream& bytes, size_t data_start, const Type& t, const FieldPath& path) {
+    if (t_has_union(t)) {
+        return read_union_field(bytes, data_start, t, path);
+    }
+    Variable v;
+    v.type = t_field(t, path);
+    uint64_t offset = t_offsetof(t, path);
+    if (bytes.readable().size() - data_start < offset + t_sizeof(v.type)) {
+        throw std::runtime_error("projected field is past the end of the data");
+    }
+    bytes.pos = data_start + offset;
+    v.data = bytes.read_bytes(t_sizeof(v.type));
+    return v;
+}
+
+// leaves bytes after the value that starts at data_start
+static void skip_value(ByteStream& bytes, size_t data_start, const Type& t) {
+    bytes.pos = data_start;
+    if (t_has_union(t)) {
+        Bytes value(t_sizeof(t));
+        read_value(bytes, t, value.data());
+    } else {
+        bytes.pos += t_sizeof(t);
+    }
+}
+
+Variable project_variable(ByteStream &bytes, const FieldPath &path) {
+    Type t = deserialize_type(bytes);
+    size_t data_start = bytes.pos;
+    Variable v = read_field(bytes, data_start, t, path);
+    skip_value(bytes, data_start, t);
+    return v;
+}
+
+std::vector<Variable> project_variables(ByteStream &bytes, const std::vector<FieldPath> &paths) {
+    Type t = deserialize_type(bytes);
+    size_t data_start = bytes.pos;
+    std::vector<Variable> vars;
+    vars.reserve(paths.size());
+    for (auto& path : paths) {
+        vars.push_back(read_field(bytes, data_start, t, path));
+    }
+    skip_value(bytes, data_start, t);
+    return vars;
+}
+
+Context project_context(const Type &t, std::byte *data, ByteSpan ctx) {
+    Context out;
+    for_each_pointer(t, data, [&](const Type& slot_type, std::byte* slot) {
+        uint64_t offset = deserialize_u64(slot);
+        if (offset > ctx.size()) {
+            throw std::runtime_error("pointer outside the context");
+        }
+        uint64_t room = ctx.size() - offset;
+        uint64_t size;
+        if (slot_type.deref_count > 0) {
+            Type pointee = slot_type.deref();
+            auto b = std::get_if<BasicType>(&pointee.type);
+            if (pointee.deref_count == 0 && b && b->bytes == 1 && !b->sign) {
+                // a null-terminated string, like new_ptr stores it
+                size = strnlen(reinterpret_cast<const char*>(ctx.data() + offset), room) + 1;
+            } else {
+                size = t_sizeof(pointee);
+            }
+        } else {
+            auto& sl = std::get<SliceType>(slot_type.type);
+            uint64_t count = deserialize_u64(slot + sizeof(void*));
+            uint64_t elem = t_sizeof(sl.elem());
+            if (elem != 0 && count > room / elem) {
+                throw std::runtime_error("slice is past the end of the context");
+            }
+            size = count * elem + (sl.string ? 1 : 0);
+        }
+        if (size > room) {
+            throw std::runtime_error("pointee is past the end of the context");
+        }
+        uint64_t to = out.append(ctx.data() + offset, size);
+        for (size_t i = 0; i < sizeof(void*); i++) {
+            slot[i] = std::byte(to >> (i * 8));
+        }
+        return true;
+    });
+    return out;
+}
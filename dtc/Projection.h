@@ -0,0 +1,64 @@
+#pragma once
+#ifndef DTC_PROJECTION_H
+#define DTC_PROJECTION_H
+
+#include "Serial.h"
+
+// decoding only some fields of a serialized variable.
+// the type header still has to be parsed, but the offsets of the requested fields come from the
+// type layout, every other field's bytes are skipped, and only the pointers inside the requested
+// fields are relocated (so the context behind the other pointers is never read)
+
+// the field at path, with its data copied out and its pointers still context offsets
+Variable project_variable(ByteStream& bytes, const FieldPath& path);
+
+// same as project_variable for several paths, the type header is only parsed once
+std::vector<Variable> project_variables(ByteStream& bytes, const std::vector<FieldPath>& paths);
+
+// a new context with only the pointees of the value of type t at data, whose pointer slots hold
+// offsets into ctx. the slots are rebased to point into the new context
+Context project_context(const Type& t, std::byte* data, ByteSpan ctx);
+
+template<typename T>
+T deserialize_field(Context& ctx, ByteSpan bytes, const FieldPath& path) {
+    ByteStream stream(bytes);
+    return primitive<T>(ctx, project_variable(stream, path));
+}
+
+template<typename T>
+T deserialize_field(Context& ctx, std::vector<std::byte>&& bytes, const FieldPath& path) {
+    ByteStream stream(std::move(bytes));
+    return primitive<T>(ctx, project_variable(stream, path));
+}
+
+// final_deserialize for a single field. only the field's own pointees are copied into the returned
+// ctx (it's empty if the field has no pointers), the rest of the context isn't touched.
+// except with FRAME_CHECKSUM: the context checksum covers all of it, so verifying it reads the
+// whole context, a checksummed frame always costs a full scan
+template<typename T>
+Deserialized<T> final_deserialize_field(const Bytes& bytes, const FieldPath& path) {
+    FrameHeader h = read_frame_header(bytes);
+    const std::byte* body = bytes.data() + h.header_size;
+    if ((h.flags & FRAME_CHECKSUM) && crc32c(0, body, h.body_size) != h.body_crc) {
+        throw std::runtime_error("frame checksum mismatch");
+    }
+    ByteStream stream = (h.flags & FRAME_COMPACT_PTR) ? ByteStream(widen_body(ByteSpan(body, h.body_size)))
+                                                      : ByteStream(ByteSpan(body, h.body_size));
+    Variable v = project_variable(stream, path);
+    ByteSpan src(body + h.body_size, h.ctx_size);
+    if ((h.flags & FRAME_CHECKSUM) && crc32c(0, src.data(), src.size()) != h.ctx_crc) {
+        throw std::runtime_error("frame checksum mismatch");
+    }
+    auto* ctx = new Context();
+    try {
+        if (t_has_pointers(v.type)) {
+            *ctx = project_context(v.type, v.data.data(), src);
+        }
+        return Deserialized<T>{primitive<T>(*ctx, std::move(v)), ctx};
+    } catch (...) {
+        delete ctx;
+        throw;
+    }
+}
+
+#endif //DTC_PROJECTION_H
@@ -1,10 +1,22 @@
 #include "Serial.h"
+#include "Plan.h"
+#include "Visit.h"
 
 ByteStream::ByteStream(std::vector<std::byte> bytes) : bytes(std::move(bytes)) {}
 
 ByteStream::ByteStream(std::initializer_list<std::byte> bytes) : bytes(bytes) {}
 
-void ByteStream::append(std::vector<std::byte> bytes_in) {
+ByteStream::ByteStream(ByteSpan bytes) : borrowed(bytes) {}
+
+ByteSpan ByteStream::readable() const {
+    return borrowed.data() ? borrowed : ByteSpan(this->bytes);
+}
+
+void ByteStream::append(const std::vector<std::byte>& bytes_in) {
+    this->bytes.insert(this->bytes.end(), bytes_in.begin(), bytes_in.end());
+}
+
+void ByteStream::append(ByteSpan bytes_in) {
     this->bytes.insert(this->bytes.end(), bytes_in.begin(), bytes_in.end());
 }
 
@@ -12,7 +24,7 @@ void ByteStream::append(std::initializer_list<std::byte> bytes_in) {
     this->bytes.insert(this->bytes.end(), bytes_in.begin(), bytes_in.end());
 }
 
-void ByteStream::append(ByteStream &other) {
+void ByteStream::append(const ByteStream &other) {
     this->bytes.insert(this->bytes.end(), other.bytes.begin(), other.bytes.end());
 }
 
@@ -21,28 +33,29 @@ void ByteStream::append(std::byte byte) {
 }
 
 std::byte ByteStream::read_byte() {
-    std::byte byte = this->bytes[0];
-    this->bytes.erase(this->bytes.begin());
-    return byte;
+    return readable()[this->pos++];
 }
 
 uint8_t ByteStream::read_u8() {
-    auto u8 = std::to_integer<uint8_t>(this->bytes[0]);
-    this->bytes.erase(this->bytes.begin());
-    return u8;
+    return std::to_integer<uint8_t>(readable()[this->pos++]);
 }
 
 std::vector<std::byte> ByteStream::read_bytes(size_t count) {
-    std::vector<std::byte> bytes_ret;
-    bytes_ret.reserve(count);
-    for (size_t i = 0; i < count; i++) {
-        bytes_ret.push_back(this->bytes[0]);
-        this->bytes.erase(this->bytes.begin());
-    }
-
+    const std::byte* begin = readable().data() + this->pos;
+    std::vector<std::byte> bytes_ret(begin, begin + count);
+    this->pos += count;
     return bytes_ret;
 }
 
+void ByteStream::skip(size_t count) {
+    this->pos += count;
+}
+
+size_t ByteStream::remaining() const {
+    size_t size = readable().size();
+    return this->pos < size ? size - this->pos : 0;
+}
+
 std::vector<std::byte> serialize_u64(uint64_t u64) {
     std::vector<std::byte> bytes;
     for (int i = 0; i < 8; i++) {
@@ -52,35 +65,110 @@ std::vector<std::byte> serialize_u64(uint64_t u64) {
     return bytes;
 }
 
+static void append_u64(ByteStream& bytes, uint64_t u64) {
+    for (int i = 0; i < 8; i++) {
+        bytes.append(std::byte(u64 >> (i * 8)));
+    }
+}
+
+namespace {
+
+// serialize_type without a temporary vector per node, everything goes straight into bytes
+struct TypeWriter {
+    ByteStream& bytes;
+
+    void write(const Type& t) {
+        append_u64(bytes, t.deref_count);
+        visit_kind(t, *this);
+    }
+
+    void on_basic(const Type&, const BasicType& b) {
+        bytes.append(std::byte(0));
+        bytes.append(std::byte(b.floating ? 2 : (b.sign ? 1 : 0)));
+        append_u64(bytes, b.bytes);
+    }
+
+    void on_struct(const Type&, const StructType& s) {
+        bytes.append(std::byte(1));
+        append_u64(bytes, s.types.size());
+        for (auto& type : s.types) {
+            write(type);
+        }
+    }
+
+    void on_slice(const Type&, const SliceType& sl) {
+        bytes.append(std::byte(2));
+        bytes.append(std::byte(sl.string ? 1 : 0));
+        write(sl.elem());
+    }
+
+    void on_array(const Type&, const ArrayType& a) {
+        bytes.append(std::byte(3));
+        append_u64(bytes, a.count);
+        write(a.elem());
+    }
+
+    void on_union(const Type&, const UnionType& u) {
+        bytes.append(std::byte(4));
+        append_u64(bytes, u.types.size());
+        for (auto& type : u.types) {
+            write(type);
+        }
+    }
+};
+
+} // namespace
+
+static void serialize_type_into(ByteStream& bytes, const Type& t) {
+    TypeWriter{bytes}.write(t);
+}
+
 std::vector<std::byte> serialize_basic_type(BasicType t) {
     ByteStream bytes;
     bytes.append(std::byte(t.floating ? 2 : (t.sign ? 1 : 0)));
-    bytes.append(serialize_u64(t.bytes));
+    append_u64(bytes, t.bytes);
     return bytes.bytes;
 }
 
 std::vector<std::byte> serialize_struct_type(const StructType& t) {
     ByteStream bytes;
-    bytes.append(serialize_u64(t.types.size()));
+    append_u64(bytes, t.types.size());
     for (auto& type : t.types) {
-        bytes.append(serialize_type(type));
+        serialize_type_into(bytes, type);
     }
     return bytes.bytes;
 }
 
 std::vector<std::byte> serialize_type(const Type &t) {
     ByteStream bytes;
-    bytes.append(serialize_u64(t.deref_count));
-    if (t.type.index() == 0) {
-        bytes.append(std::byte(0));
-        bytes.append(serialize_basic_type(std::get<BasicType>(t.type)));
-    } else {
-        bytes.append(std::byte(1));
-        bytes.append(serialize_struct_type(std::get<StructType>(t.type)));
+    bytes.bytes.reserve(serialized_type_size(t));
+    serialize_type_into(bytes, t);
+    return std::move(bytes.bytes);
+}
+
+std::vector<std::byte> serialize_array_type(const ArrayType& t) {
+    ByteStream bytes;
+    append_u64(bytes, t.count);
+    serialize_type_into(bytes, t.elem());
+    return bytes.bytes;
+}
+
+std::vector<std::byte> serialize_union_type(const UnionType& t) {
+    ByteStream bytes;
+    append_u64(bytes, t.types.size());
+    for (auto& type : t.types) {
+        serialize_type_into(bytes, type);
     }
     return bytes.bytes;
 }
 
+std::vector<std::byte> serialize_slice_type(const SliceType& t) {
+    ByteStream bytes;
+    bytes.append(std::byte(t.string ? 1 : 0));
+    serialize_type_into(bytes, t.elem());
+    return bytes.bytes;
+}
+
 StructType deserialize_struct_type(ByteStream &bytes) {
     StructType t;
     uint64_t num_types = deserialize_u64(bytes);
@@ -93,17 +181,50 @@ StructType deserialize_struct_type(ByteStream &bytes) {
 Type deserialize_type(ByteStream &bytes) {
     Type t;
     t.deref_count = deserialize_u64(bytes);
-    if (bytes.read_u8() == 0) {
+    uint8_t typetype = bytes.read_u8();
+    if (typetype == 0) {
         t.type = deserialize_basic_type(bytes);
-    } else {
+    } else if (typetype == 1) {
         t.type = deserialize_struct_type(bytes);
+    } else if (typetype == 2) {
+        t.type = deserialize_slice_type(bytes);
+    } else if (typetype == 3) {
+        t.type = deserialize_array_type(bytes);
+    } else if (typetype == 4) {
+        t.type = deserialize_union_type(bytes);
+    } else {
+        throw std::runtime_error("unknown typetype");
     }
     return t;
 }
 
+ArrayType deserialize_array_type(ByteStream &bytes) {
+    uint64_t count = deserialize_u64(bytes);
+    return ArrayType(deserialize_type(bytes), count);
+}
+
+UnionType deserialize_union_type(ByteStream &bytes) {
+    UnionType t;
+    uint64_t num_types = deserialize_u64(bytes);
+    for (size_t i = 0; i < num_types; i++) {
+        t.types.push_back(deserialize_type(bytes));
+    }
+    return t;
+}
+
+SliceType deserialize_slice_type(ByteStream &bytes) {
+    bool string = bytes.read_u8() == 1;
+    return SliceType(deserialize_type(bytes), string);
+}
+
 Variable deserialize_variable(ByteStream &bytes) {
     Variable v;
     v.type = deserialize_type(bytes);
+    if (t_has_union(v.type)) {
+        v.data.resize(t_sizeof(v.type));
+        read_value(bytes, v.type, v.data.data());
+        return v;
+    }
     v.data = bytes.read_bytes(t_sizeof(v.type));
     return v;
 }
@@ -125,11 +246,192 @@ uint64_t deserialize_u64(ByteStream &bytes) {
     return u64;
 }
 
+uint64_t deserialize_u64(const std::byte *bytes) {
+    uint64_t u64 = 0;
+    for (int i = 0; i < 8; i++) {
+        u64 |= std::to_integer<uint64_t>(bytes[i]) << (i * 8);
+    }
+    return u64;
+}
+
+void write_value(Bytes &out, const Type &t, const std::byte *data) {
+    if (!t_has_union(t)) {
+        out.insert(out.end(), data, data + t_sizeof(t));
+        return;
+    }
+    if (t.is_union()) {
+        out.insert(out.end(), data, data + 4);
+    }
+    for_each_member(t, data, [&](const Type& member, const std::byte* d) {
+        write_value(out, member, d);
+        return true;
+    });
+}
+
+void read_value(ByteStream &bytes, const Type &t, std::byte *out) {
+    if (!t_has_union(t)) {
+        uint64_t size = t_sizeof(t);
+        if (bytes.remaining() < size) {
+            throw std::runtime_error("value is past the end of the data");
+        }
+        if (size > 0) {
+            std::memcpy(out, bytes.readable().data() + bytes.pos, size);
+        }
+        bytes.skip(size);
+        return;
+    }
+    if (t.is_union()) {
+        if (bytes.remaining() < 4) {
+            throw std::runtime_error("value is past the end of the data");
+        }
+        std::memcpy(out, bytes.readable().data() + bytes.pos, 4);
+        bytes.skip(4);
+    }
+    for_each_member(t, out, [&](const Type& member, std::byte* d) {
+        read_value(bytes, member, d);
+        if (t.is_union()) {
+            uint64_t size = t_sizeof(member);
+            std::memset(d + size, 0, t_sizeof(t) - 4 - size); // the room for the larger members
+        }
+        return true;
+    });
+}
+
 std::vector<std::byte> serialize_variable(const Variable &v) {
-    ByteStream bytes;
-    bytes.append(serialize_type(v.type));
-    bytes.append(v.data);
-    return bytes.bytes;
+    std::vector<std::byte> bytes = serialize_type(v.type);
+    if (t_has_union(v.type)) {
+        write_value(bytes, v.type, v.data.data());
+        return bytes;
+    }
+    bytes.insert(bytes.end(), v.data.begin(), v.data.end());
+    return bytes;
+}
+
+uint64_t frame_header_size(uint8_t flags) {
+    uint64_t size = 8;
+    if (flags & FRAME_SIZED) {
+        size += 8;
+    }
+    if (flags & FRAME_FINGERPRINT) {
+        size += 8;
+    }
+    if (flags & FRAME_CHECKSUM) {
+        size += 8;
+    }
+    return size;
+}
+
+static void store_u64(std::byte* p, uint64_t v) {
+    for (int i = 0; i < 8; i++) {
+        p[i] = std::byte(v >> (i * 8));
+    }
+}
+
+void put_frame_header(std::byte *dst, const FrameHeader &h) {
+    if (h.body_size > FRAME_SIZE_MASK) {
+        throw std::runtime_error("frame body too large");
+    }
+    store_u64(dst, h.body_size | (uint64_t(h.flags) << 56));
+    dst += 8;
+    if (h.flags & FRAME_SIZED) {
+        store_u64(dst, h.ctx_size);
+        dst += 8;
+    }
+    if (h.flags & FRAME_FINGERPRINT) {
+        store_u64(dst, h.fingerprint);
+        dst += 8;
+    }
+    if (h.flags & FRAME_CHECKSUM) {
+        store_u64(dst, h.body_crc | (uint64_t(h.ctx_crc) << 32));
+    }
+}
+
+Bytes write_frame(const Bytes &body, const Context &ctx, uint8_t flags, uint64_t fingerprint) {
+    FrameHeader h;
+    h.flags = flags;
+    h.header_size = frame_header_size(flags);
+    h.body_size = body.size();
+    h.ctx_size = ctx.size();
+    h.fingerprint = fingerprint;
+    if (flags & FRAME_CHECKSUM) {
+        h.body_crc = crc32c(body);
+        h.ctx_crc = crc32c(ctx);
+    }
+    Bytes final(h.frame_size());
+    put_frame_header(final.data(), h);
+    std::copy(body.begin(), body.end(), final.begin() + std::ptrdiff_t(h.header_size));
+    std::copy(ctx.begin(), ctx.end(), final.begin() + std::ptrdiff_t(h.header_size + h.body_size));
+    return final;
+}
+
+static uint32_t load_u32(const std::byte* p) {
+    uint32_t v = 0;
+    for (int i = 0; i < 4; i++) {
+        v |= std::to_integer<uint32_t>(p[i]) << (i * 8);
+    }
+    return v;
+}
+
+bool parse_frame_header(ByteSpan bytes, FrameHeader &h) {
+    if (bytes.size() < 8) {
+        return false;
+    }
+    h = FrameHeader{};
+    uint64_t word = deserialize_u64(bytes.data());
+    h.flags = uint8_t(word >> 56);
+    h.body_size = word & FRAME_SIZE_MASK;
+    h.header_size = 8;
+    if (h.flags & FRAME_SIZED) {
+        if (bytes.size() < h.header_size + 8) {
+            return false;
+        }
+        h.ctx_size = deserialize_u64(bytes.data() + h.header_size);
+        h.header_size += 8;
+    }
+    if (h.flags & FRAME_FINGERPRINT) {
+        if (bytes.size() < h.header_size + 8) {
+            return false;
+        }
+        h.fingerprint = deserialize_u64(bytes.data() + h.header_size);
+        h.header_size += 8;
+    }
+    if (h.flags & FRAME_CHECKSUM) {
+        if (bytes.size() < h.header_size + 8) {
+            return false;
+        }
+        h.body_crc = load_u32(bytes.data() + h.header_size);
+        h.ctx_crc = load_u32(bytes.data() + h.header_size + 4);
+        h.header_size += 8;
+    }
+    if (bytes.size() - h.header_size < h.body_size) {
+        return false;
+    }
+    if (h.flags & FRAME_SIZED) {
+        if (bytes.size() - h.header_size - h.body_size < h.ctx_size) {
+            return false;
+        }
+    } else {
+        h.ctx_size = bytes.size() - h.header_size - h.body_size;
+    }
+    return true;
+}
+
+FrameHeader read_frame_header(ByteSpan bytes) {
+    FrameHeader h;
+    if (!parse_frame_header(bytes, h)) {
+        throw std::runtime_error("frame truncated");
+    }
+    return h;
+}
+
+bool verify_frame(ByteSpan bytes) {
+    FrameHeader h = read_frame_header(bytes);
+    if (!(h.flags & FRAME_CHECKSUM)) {
+        return true;
+    }
+    const std::byte* body = bytes.data() + h.header_size;
+    return crc32c(0, body, h.body_size) == h.body_crc &&
+           crc32c(0, body + h.body_size, h.ctx_size) == h.ctx_crc;
 }
 
 //template<typename T>
@@ -149,3 +451,174 @@ std::vector<std::byte> serialize_variable(const Variable &v) {
 //    std::memcpy(v.data.data(), &val, sizeof(T));
 //    return v;
 //}
+
+void copy_frame_sections(ByteSpan bytes, const FrameHeader &h, Bytes &body, Context &ctx) {
+    const std::byte* src = bytes.data() + h.header_size;
+    body.resize(h.body_size);
+    ctx.resize(h.ctx_size);
+    if (h.flags & FRAME_CHECKSUM) {
+        // verify while copying the sections out, so the data is only read once
+        bool ok = crc32c_copy(0, body.data(), src, h.body_size) == h.body_crc;
+        ok = crc32c_copy(0, ctx.data(), src + h.body_size, h.ctx_size) == h.ctx_crc && ok;
+        if (!ok) {
+            throw std::runtime_error("frame checksum mismatch");
+        }
+    } else {
+        std::copy(src, src + h.body_size, body.begin());
+        std::copy(src + h.body_size, src + h.body_size + h.ctx_size, ctx.begin());
+    }
+}
+
+ByteSpan copy_frame_context(ByteSpan bytes, const FrameHeader &h, Context &ctx) {
+    ByteSpan body = bytes.subspan(h.header_size, h.body_size);
+    const std::byte* src = body.end();
+    ctx.resize(h.ctx_size);
+    if (h.flags & FRAME_CHECKSUM) {
+        bool ok = crc32c(0, body.data(), body.size()) == h.body_crc;
+        ok = crc32c_copy(0, ctx.data(), src, h.ctx_size) == h.ctx_crc && ok;
+        if (!ok) {
+            throw std::runtime_error("frame checksum mismatch");
+        }
+    } else {
+        std::copy(src, src + h.ctx_size, ctx.begin());
+    }
+    return body;
+}
+
+uint64_t compact_pointers(std::byte *value, uint64_t size, const std::vector<uint64_t> &pointers) {
+    // everything moves down, never up, so it can be done in place front to back
+    uint64_t from = 0, to = 0;
+    for (uint64_t off : pointers) {
+        if (off < from || off > size || size - off < 8) {
+            throw std::runtime_error("pointer slot outside the value");
+        }
+        if (deserialize_u64(value + off) > UINT32_MAX) {
+            throw std::runtime_error("pointer too large for a compact frame");
+        }
+        std::memmove(value + to, value + from, off - from + 4);
+        to += off - from + 4;
+        from = off + 8;
+    }
+    std::memmove(value + to, value + from, size - from);
+    return to + size - from;
+}
+
+void widen_pointers(const std::byte *src, std::byte *dst, uint64_t size, const std::vector<uint64_t> &pointers) {
+    uint64_t from = 0, to = 0;
+    for (uint64_t off : pointers) {
+        if (off < to || off > size || size - off < 8) {
+            throw std::runtime_error("pointer slot outside the value");
+        }
+        std::memcpy(dst + to, src + from, off - to + 4);
+        std::memset(dst + off + 4, 0, 4);
+        from += off - to + 4;
+        to = off + 8;
+    }
+    std::memcpy(dst + to, src + from, size - to);
+}
+
+Bytes widen_body(ByteSpan body) {
+    ByteStream stream(body);
+    Type t = deserialize_type(stream);
+    uint64_t header = serialized_type_size(t);
+    uint64_t size = t_sizeof(t);
+    std::vector<uint64_t> pointers = t_pointer_offsets(t);
+    if (pointers.size() > size / 8 || body.size() - header != size - pointers.size() * 4) {
+        throw std::runtime_error("value is past the end of the data");
+    }
+    Bytes wide(header + size);
+    std::copy(body.begin(), body.begin() + header, wide.begin());
+    widen_pointers(body.data() + header, wide.data() + header, size, pointers);
+    return wide;
+}
+
+namespace {
+
+// the size of what serialize_type writes
+struct TypeSize {
+    uint64_t size(const Type& t) {
+        return 8 + 1 + visit_kind(t, *this); // deref_count, typetype
+    }
+
+    uint64_t on_basic(const Type&, const BasicType&) {
+        return 1 + 8;
+    }
+
+    uint64_t on_struct(const Type&, const StructType& s) {
+        uint64_t total = 8;
+        for (auto& tp : s.types) {
+            total += size(tp);
+        }
+        return total;
+    }
+
+    uint64_t on_slice(const Type&, const SliceType& sl) {
+        return 1 + size(sl.elem());
+    }
+
+    uint64_t on_array(const Type&, const ArrayType& a) {
+        return 8 + size(a.elem());
+    }
+
+    uint64_t on_union(const Type&, const UnionType& u) {
+        uint64_t total = 8;
+        for (auto& tp : u.types) {
+            total += size(tp);
+        }
+        return total;
+    }
+};
+
+} // namespace
+
+uint64_t serialized_type_size(const Type &t) {
+    return TypeSize{}.size(t);
+}
+
+Variable deserialize_variable(ByteStream &bytes, const Type &expected, uint64_t fingerprint) {
+    Variable v;
+    if (fingerprint != 0) {
+        if (fingerprint != expected.fingerprint()) {
+            throw std::runtime_error("schema fingerprint mismatch");
+        }
+        bytes.skip(serialized_type_size(expected));
+    } else if (deserialize_type(bytes).fingerprint() != expected.fingerprint()) {
+        throw std::runtime_error("schema fingerprint mismatch");
+    }
+    v.type = expected;
+    uint64_t size = t_sizeof(expected);
+    if (t_has_union(expected)) {
+        v.data.resize(size);
+        read_value(bytes, expected, v.data.data());
+        return v;
+    }
+    if (bytes.remaining() < size) {
+        throw std::runtime_error("value is past the end of the data");
+    }
+    v.data = bytes.read_bytes(size);
+    return v;
+}
+
+Bytes serialize_frame(const void *val, const Type &t, uint8_t flags) {
+    const Plan& plan = plan_for(t);
+    Context ctx;
+    ctx.intern_strings = (flags & FRAME_INTERNED) != 0;
+    Bytes body;
+    plan_encode(plan, val, ctx, body);
+    if (flags & FRAME_COMPACT_PTR) {
+        if (plan.pointers.empty() || ctx.size() > UINT32_MAX) {
+            flags &= uint8_t(~FRAME_COMPACT_PTR);
+        } else {
+            uint64_t header = plan.header.size();
+            body.resize(header + compact_pointers(body.data() + header, plan.size, plan.pointers));
+        }
+    }
+    return write_frame(body, ctx, flags, plan.fingerprint);
+}
+
+void deserialize_frame_into(ByteSpan bytes, const Type &expected, void *out, Context &ctx) {
+    FrameHeader h = read_frame_header(bytes);
+    ByteSpan body = copy_frame_context(bytes, h, ctx);
+    plan_decode(plan_for(expected), body, ctx, out, (h.flags & FRAME_FINGERPRINT) ? h.fingerprint : 0,
+                (h.flags & FRAME_COMPACT_PTR) != 0);
+}
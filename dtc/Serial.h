@@ -11,12 +11,13 @@
 #include <variant>
 #include <algorithm>
 #include "DynTypC.h"
+#include "Checksum.h"
 
 // FORMAT SPECS
 // little endian
 // Type:
 //  - deref_count: u64
-//  - typetype: u8 (0 for basic, 1 for struct)
+//  - typetype: u8 (0 for basic, 1 for struct, 2 for slice, 3 for array)
 //  - data for the respective type
 
 // BasicType:
@@ -27,6 +28,15 @@
 //  - num_types: u64
 //  - types: Type[num_types]
 
+// SliceType:
+//  - flags: u8 (1 for a string slice)
+//  - element: Type
+// a slice value is { ptr: u64 (context offset), count: u64 }
+
+// ArrayType:
+//  - count: u64
+//  - element: Type
+
 // Example:
 
 // struct {
@@ -77,9 +87,31 @@
 //           ]
 //    ]
 
+// non-owning view of some bytes (like std::span<const std::byte>), for reading records in place
+struct ByteSpan {
+    const std::byte* ptr = nullptr;
+    size_t len = 0;
+
+    ByteSpan() = default;
+    ByteSpan(const std::byte* ptr, size_t len) : ptr(ptr), len(len) {}
+    ByteSpan(const std::vector<std::byte>& bytes) : ptr(bytes.data()), len(bytes.size()) {}
+
+    [[nodiscard]] const std::byte* data() const { return ptr; }
+    [[nodiscard]] size_t size() const { return len; }
+    [[nodiscard]] const std::byte* begin() const { return ptr; }
+    [[nodiscard]] const std::byte* end() const { return ptr + len; }
+    const std::byte& operator[](size_t i) const { return ptr[i]; }
+
+    [[nodiscard]] ByteSpan subspan(size_t offset, size_t count) const {
+        return {ptr + offset, count};
+    }
+};
+
 // to make it easier
 struct ByteStream {
     std::vector<std::byte> bytes;
+    size_t pos = 0; // read position, reading doesn't erase anything
+    ByteSpan borrowed{}; // set when reading someone else's buffer instead of bytes
 
     // basically just a wrapper around std::vector<std::byte>
     // mostly the same, but with like 1 extra functions for appending a vector of bytes easily
@@ -88,11 +120,20 @@ struct ByteStream {
     explicit ByteStream(std::vector<std::byte> bytes);
     ByteStream(std::initializer_list<std::byte> bytes);
 
-    void append(std::vector<std::byte> bytes_in);
+    // reads straight out of bytes without copying them, which have to outlive the stream.
+    // a borrowing stream is only for reading
+    explicit ByteStream(ByteSpan bytes);
+
+    // what reading goes through, the borrowed buffer or bytes
+    [[nodiscard]] ByteSpan readable() const;
+
+    void append(const std::vector<std::byte>& bytes_in);
+
+    void append(ByteSpan bytes_in);
 
     void append(std::initializer_list<std::byte> bytes_in);
 
-    void append(ByteStream& other);
+    void append(const ByteStream& other);
 
     void append(std::byte byte);
 
@@ -103,6 +144,10 @@ struct ByteStream {
     uint8_t read_u8();
 
     std::vector<std::byte> read_bytes(size_t count);
+
+    void skip(size_t count);
+
+    [[nodiscard]] size_t remaining() const;
 };
 
 std::vector<std::byte> serialize_u64(uint64_t u64);
@@ -113,56 +158,171 @@ std::vector<std::byte> serialize_type(const Type& t);
 
 std::vector<std::byte> serialize_struct_type(const StructType& t);
 
+std::vector<std::byte> serialize_slice_type(const SliceType& t);
+
+std::vector<std::byte> serialize_array_type(const ArrayType& t);
+
+std::vector<std::byte> serialize_union_type(const UnionType& t);
+
 std::vector<std::byte> serialize_type(const Type& t);
 
 std::vector<std::byte> serialize_variable(const Variable& v);
 
+// appends a value of type t as it's serialized: its bytes, except that each union only has its
+// tag and its active member's bytes
+void write_value(std::vector<std::byte>& out, const Type& t, const std::byte* data);
+
+// reads what write_value wrote into out (t_sizeof(t) bytes), the room a union's active member
+// doesn't use is zeroed
+void read_value(ByteStream& bytes, const Type& t, std::byte* out);
+
 uint64_t deserialize_u64(ByteStream& bytes);
 
+// reads a little endian u64 straight out of a buffer
+uint64_t deserialize_u64(const std::byte* bytes);
+
 BasicType deserialize_basic_type(ByteStream& bytes);
 
 Type deserialize_type(ByteStream& bytes);
 
 StructType deserialize_struct_type(ByteStream& bytes);
 
+SliceType deserialize_slice_type(ByteStream& bytes);
+
+ArrayType deserialize_array_type(ByteStream& bytes);
+
+UnionType deserialize_union_type(ByteStream& bytes);
+
 Type deserialize_type(ByteStream& bytes);
 
 Variable deserialize_variable(ByteStream& bytes);
 
 template<typename T>
-T deserialize(Context& ctx, std::vector<std::byte> bytes) {
-    ByteStream stream(std::move(bytes));
+T deserialize(Context& ctx, ByteSpan bytes) {
+    ByteStream stream(bytes);
     return primitive<T>(ctx, deserialize_variable(stream));
 }
 
 template<typename T>
-std::vector<std::byte> serialize(Context& ctx, T val, const Type &t) {
-    return serialize_variable(construct_variable(ctx, val, t));
+T deserialize(Context& ctx, std::vector<std::byte>&& bytes) {
+    ByteStream stream(std::move(bytes));
+    return primitive<T>(ctx, deserialize_variable(stream));
 }
 
 template<typename T>
-Variable construct_variable(Context& ctx, T val, const Type &t) {
+Variable construct_variable(Context& ctx, const T& val, const Type &t) {
     std::vector<std::byte> bytes;
     uint64_t size = sizeof(T);
     // bytes of the value
     bytes.resize(size);
     std::memcpy(bytes.data(), &val, size);
-    Variable v = Variable(ctx, t, bytes);
-    return v;
+    return Variable(ctx, t, std::move(bytes));
+}
+
+template<typename T>
+std::vector<std::byte> serialize(Context& ctx, const T& val, const Type &t) {
+    return serialize_variable(construct_variable(ctx, val, t));
 }
 
 typedef std::vector<std::byte> Bytes;
 
+// Frame (what final_serialize produces):
+//  - header: u64 (low 56 bits: body size, high 8 bits: FrameFlags)
+//  - [FRAME_SIZED] ctx_size: u64
+//  - [FRAME_FINGERPRINT] fingerprint: u64 (Type::fingerprint of the value's type)
+//  - [FRAME_CHECKSUM] body_crc: u32, ctx_crc: u32 (CRC32C of the body and of the context)
+//  - body: serialized variable ([FRAME_COMPACT_PTR] with each pointer slot cut to its low 4 bytes)
+//  - context: all remaining bytes, or ctx_size bytes for a sized frame
+// a header without flags is the original format, so old files still load
+
+enum FrameFlags : uint8_t {
+    FRAME_CHECKSUM = 1 << 0,
+    FRAME_SIZED = 1 << 1, // self-delimiting, so frames can be stored back to back
+    FRAME_FINGERPRINT = 1 << 2,
+    FRAME_INTERNED = 1 << 3, // strings were interned, several pointers can share one pointee
+    // pointer slots in the value are u32 context offsets instead of u64. asking for it is a hint,
+    // the writer only sets it when the context is under 4 GiB and the value has pointers
+    FRAME_COMPACT_PTR = 1 << 4,
+};
+
+const uint8_t FRAME_DEFAULT = FRAME_FINGERPRINT;
+
+// every flag this version understands
+const uint8_t FRAME_KNOWN_FLAGS = FRAME_CHECKSUM | FRAME_SIZED | FRAME_FINGERPRINT | FRAME_INTERNED | FRAME_COMPACT_PTR;
+
+const uint64_t FRAME_SIZE_MASK = (uint64_t(1) << 56) - 1;
+
+struct FrameHeader {
+    uint8_t flags = 0;
+    uint64_t header_size = 0; // bytes before the body
+    uint64_t body_size = 0;
+    uint64_t ctx_size = 0;
+    uint64_t fingerprint = 0;
+    uint32_t body_crc = 0;
+    uint32_t ctx_crc = 0;
+
+    [[nodiscard]] uint64_t frame_size() const {
+        return header_size + body_size + ctx_size;
+    }
+};
+
+Bytes write_frame(const Bytes& body, const Context& ctx, uint8_t flags=0, uint64_t fingerprint=0);
+
+// bytes before the body in a frame with these flags
+uint64_t frame_header_size(uint8_t flags);
+
+// writes the header of a frame (the fields h.flags asks for) to dst, frame_header_size(h.flags) bytes
+void put_frame_header(std::byte* dst, const FrameHeader& h);
+
+// throws if the buffer is too short for the sizes in the header
+FrameHeader read_frame_header(ByteSpan bytes);
+
+// read_frame_header that returns false instead of throwing
+bool parse_frame_header(ByteSpan bytes, FrameHeader& h);
+
+// true if the frame has no checksums, or if both sections match theirs
+bool verify_frame(ByteSpan bytes);
+
+// copies the body and context out of a frame, verifying their checksums on the way
+void copy_frame_sections(ByteSpan bytes, const FrameHeader& h, Bytes& body, Context& ctx);
+
+// copies only the context out (the body is read in place), verifying both checksums.
+// returns the body, inside bytes
+ByteSpan copy_frame_context(ByteSpan bytes, const FrameHeader& h, Context& ctx);
+
+// squeezes the pointer slots (offsets in the value, like t_pointer_offsets, in order) of the value
+// of size bytes down to their low 4 bytes, in place. returns the new size.
+// throws if a slot isn't inside the value or the slots aren't in order (same for widen_pointers)
+uint64_t compact_pointers(std::byte* value, uint64_t size, const std::vector<uint64_t>& pointers);
+
+// the reverse of compact_pointers: src is the compact value, dst gets the size bytes of the full one
+void widen_pointers(const std::byte* src, std::byte* dst, uint64_t size, const std::vector<uint64_t>& pointers);
+
+// the body of a FRAME_COMPACT_PTR frame (type header + compact value) with its pointers widened,
+// so it can be read like any other body
+Bytes widen_body(ByteSpan body);
+
+// the size of serialize_type(t), without serializing it
+uint64_t serialized_type_size(const Type& t);
+
+// deserialize_variable for a value that has to be of type expected. with a fingerprint (from the
+// frame header) the check is one compare and the type header is skipped instead of parsed,
+// with fingerprint 0 the header is parsed and its fingerprint compared
+Variable deserialize_variable(ByteStream& bytes, const Type& expected, uint64_t fingerprint);
+
+// a frame of the value of type t at val, encoded with t's cached plan (see Plan.h)
+Bytes serialize_frame(const void* val, const Type& t, uint8_t flags);
+
+// decodes a frame holding a value of type expected into out, with the value's pointers into ctx
+// (which is replaced). decoded with expected's cached plan
+void deserialize_frame_into(ByteSpan bytes, const Type& expected, void* out, Context& ctx);
+
 template<typename T>
-Bytes final_serialize(T val, const Type &t) {
-    Context ctx;
-    Bytes b = serialize(ctx, val, t);
-    // format: serialized size, serialized data, context
-    Bytes final;
-    final = serialize_u64(b.size());
-    final.insert(final.end(), b.begin(), b.end());
-    final.insert(final.end(), ctx.begin(), ctx.end());
-    return final;
+Bytes final_serialize(const T& val, const Type &t, uint8_t flags=FRAME_DEFAULT) {
+    if (sizeof(T) != t_sizeof(t)) {
+        throw std::runtime_error("primitive type size mismatch");
+    }
+    return serialize_frame(&val, t, flags);
 }
 
 template<typename T>
@@ -172,16 +332,36 @@ struct Deserialized {
 };
 
 template<typename T>
-Deserialized<T> final_deserialize(Bytes bytes) {
-    ByteStream stream(bytes);
-    uint64_t size = deserialize_u64(stream);
-    Bytes b = Bytes(bytes.begin() + 8, bytes.begin() + 8 + size);
-    Bytes ctx_bytes(bytes.begin() + 8 + size, bytes.end());
+Deserialized<T> final_deserialize(ByteSpan bytes) {
+    FrameHeader h = read_frame_header(bytes);
     // when we make this context, it must outlive this function, because all the data returned will point to the context
-    Context* ctx = new Context();
-    ctx->resize(ctx_bytes.size());
-    std::copy(ctx_bytes.begin(), ctx_bytes.end(), ctx->begin());
-    return Deserialized<T>{deserialize<T>(*ctx, b), ctx};
+    auto* ctx = new Context();
+    try {
+        ByteSpan body = copy_frame_context(bytes, h, *ctx);
+        if (h.flags & FRAME_COMPACT_PTR) {
+            return Deserialized<T>{deserialize<T>(*ctx, widen_body(body)), ctx};
+        }
+        return Deserialized<T>{deserialize<T>(*ctx, body), ctx};
+    } catch (...) {
+        delete ctx;
+        throw;
+    }
+}
+
+// final_deserialize that also checks the record is of type expected (not just the same size as T)
+template<typename T>
+Deserialized<T> final_deserialize(ByteSpan bytes, const Type& expected) {
+    if (sizeof(T) != t_sizeof(expected)) {
+        throw std::runtime_error("primitive type size mismatch");
+    }
+    Deserialized<T> res{T{}, new Context()};
+    try {
+        deserialize_frame_into(bytes, expected, &res.val, *res.ctx);
+        return res;
+    } catch (...) {
+        delete res.ctx;
+        throw;
+    }
 }
 
 
@@ -0,0 +1,89 @@
+#include "Serializer.h"
+
+const Plan &Serializer::plan(const Type &t) {
+    uint64_t fp = t.fingerprint();
+    if (last && last->fingerprint == fp && last->type == t) {
+        return *last;
+    }
+    // plan_for tells types with the same fingerprint apart, so only its answer replaces an entry
+    auto it = plans.find(fp);
+    if (it == plans.end() || !(it->second->type == t)) {
+        it = plans.insert_or_assign(fp, &plan_for(t)).first;
+    }
+    last = it->second;
+    return *last;
+}
+
+ByteSpan Serializer::serialize_value(const void *val, const Type &t, uint8_t flags) {
+    reset();
+    return append_value(val, t, flags);
+}
+
+ByteSpan Serializer::append_value(const void *val, const Type &t, uint8_t flags) {
+    const Plan& p = plan(t);
+    FrameHeader h;
+    h.fingerprint = p.fingerprint;
+    uint64_t start = out.size();
+
+    if (p.flat && !(flags & (FRAME_INTERNED | FRAME_COMPACT_PTR))) {
+        // sizes are known up front, so the value and its pointees go straight into the frame
+        h.flags = flags;
+        h.header_size = frame_header_size(flags);
+        h.body_size = p.header.size() + p.size;
+        h.ctx_size = plan_context_size(p, val);
+        out.resize(start + h.frame_size());
+        std::byte* frame = out.data() + start;
+        try {
+            plan_encode_to(p, val, frame + h.header_size, frame + h.header_size + h.body_size);
+        } catch (...) {
+            out.resize(start);
+            throw;
+        }
+    } else {
+        // the context size depends on interning (and compaction on the context size), so encode
+        // into the session's body and context first, then copy them in
+        body.clear();
+        ctx.clear();
+        ctx.strings.clear();
+        ctx.intern_strings = (flags & FRAME_INTERNED) != 0;
+        plan_encode(p, val, ctx, body);
+        if (flags & FRAME_COMPACT_PTR) {
+            if (p.pointers.empty() || ctx.size() > UINT32_MAX) {
+                flags &= uint8_t(~FRAME_COMPACT_PTR);
+            } else {
+                uint64_t header = p.header.size();
+                body.resize(header + compact_pointers(body.data() + header, p.size, p.pointers));
+            }
+        }
+        h.flags = flags;
+        h.header_size = frame_header_size(flags);
+        h.body_size = body.size();
+        h.ctx_size = ctx.size();
+        out.resize(start + h.frame_size());
+        std::byte* frame = out.data() + start;
+        std::copy(body.begin(), body.end(), frame + h.header_size);
+        std::copy(ctx.begin(), ctx.end(), frame + h.header_size + h.body_size);
+    }
+
+    std::byte* frame = out.data() + start;
+    if (flags & FRAME_CHECKSUM) {
+        h.body_crc = crc32c(0, frame + h.header_size, h.body_size);
+        h.ctx_crc = crc32c(0, frame + h.header_size + h.body_size, h.ctx_size);
+    }
+    put_frame_header(frame, h);
+    return {frame, h.frame_size()};
+}
+
+ByteSpan Serializer::bytes() const {
+    return out;
+}
+
+void Serializer::reset() {
+    out.clear();
+}
+
+void Serializer::shrink() {
+    out = Bytes();
+    body = Bytes();
+    ctx = Context();
+}
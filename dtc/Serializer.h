@@ -0,0 +1,66 @@
+#pragma once
+#ifndef DTC_SERIALIZER_H
+#define DTC_SERIALIZER_H
+
+#include <unordered_map>
+#include "Plan.h"
+
+// a serialization session, for writing many records in a loop.
+// final_serialize makes a new context, body and frame for every record and frees them after,
+// a Serializer keeps its buffers (and the context's string map) between records, so once they've
+// grown to fit the biggest record nothing is allocated anymore and a record only costs its bytes.
+// it also remembers the plans it used, so it doesn't take plan_for's lock for every record.
+// the frames are the same as final_serialize's, byte for byte.
+// one session per thread, it isn't thread safe.
+
+struct Serializer {
+    Serializer() = default;
+
+    Serializer(const Serializer&) = delete;
+    Serializer& operator=(const Serializer&) = delete;
+
+    // the frame of the value of type t at val (like serialize_frame), in the session's buffer.
+    // the span is valid until the next call that writes or resets
+    ByteSpan serialize_value(const void* val, const Type& t, uint8_t flags=FRAME_DEFAULT);
+
+    template<typename T>
+    ByteSpan serialize(const T& val, const Type& t, uint8_t flags=FRAME_DEFAULT) {
+        if (sizeof(T) != plan(t).size) {
+            throw std::runtime_error("primitive type size mismatch");
+        }
+        return serialize_value(&val, t, flags);
+    }
+
+    // appends a frame after the ones already in the buffer (since the last reset), so a run of
+    // sized frames can be built up and written out in one go. returns the new frame
+    ByteSpan append_value(const void* val, const Type& t, uint8_t flags=FRAME_DEFAULT | FRAME_SIZED);
+
+    template<typename T>
+    ByteSpan append(const T& val, const Type& t, uint8_t flags=FRAME_DEFAULT | FRAME_SIZED) {
+        if (sizeof(T) != plan(t).size) {
+            throw std::runtime_error("primitive type size mismatch");
+        }
+        return append_value(&val, t, flags);
+    }
+
+    // every frame written since the last reset
+    [[nodiscard]] ByteSpan bytes() const;
+
+    // empties the buffer, keeping what it allocated
+    void reset();
+
+    // frees the buffers (for a session that wrote one huge record and now writes small ones)
+    void shrink();
+
+    // plan_for(t), from the session's cache
+    const Plan& plan(const Type& t);
+
+private:
+    Bytes out{};
+    Bytes body{};
+    Context ctx{};
+    std::unordered_map<uint64_t, const Plan*> plans{}; // by fingerprint, like plan_for
+    const Plan* last = nullptr;
+};
+
+#endif //DTC_SERIALIZER_H
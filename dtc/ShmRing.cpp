@@ -0,0 +1,225 @@
+#include "ShmRing.h"
+#include <cerrno>
+#include <new>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const uint64_t RING_MAGIC = 0x474e495254434454; // "TDCTRING"
+static const uint64_t RECORD_COMMITTED = uint64_t(1) << 63;
+static const uint64_t RECORD_PAD = uint64_t(1) << 62;
+static const uint64_t RECORD_SIZE_MASK = RECORD_PAD - 1;
+
+// the data starts on a cache line after the header
+static const uint64_t DATA_OFFSET = (sizeof(ShmRingHeader) + 63) / 64 * 64;
+
+static std::runtime_error errno_error(const std::string& what) {
+    return std::runtime_error(what + ": " + std::strerror(errno));
+}
+
+static uint64_t record_size(uint64_t payload) {
+    return 8 + (payload + 7) / 8 * 8;
+}
+
+ShmRing::ShmRing(void *map, uint64_t size)
+        : header(static_cast<ShmRingHeader*>(map)), data(static_cast<std::byte*>(map) + DATA_OFFSET), mapped(size) {}
+
+ShmRing ShmRing::create(const std::string &name, uint64_t capacity) {
+    if (capacity < 64 || (capacity & (capacity - 1)) != 0) {
+        throw std::runtime_error("ring capacity has to be a power of two of at least 64");
+    }
+    int fd = ::shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) {
+        throw errno_error("could not create " + name);
+    }
+    uint64_t size = DATA_OFFSET + capacity;
+    if (::ftruncate(fd, off_t(size)) != 0) {
+        auto e = errno_error("could not size " + name);
+        ::close(fd);
+        ::shm_unlink(name.c_str());
+        throw e;
+    }
+    void* map = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        auto e = errno_error("could not map " + name);
+        ::shm_unlink(name.c_str());
+        throw e;
+    }
+    // ftruncate zeroed everything, which is an empty ring. the magic goes in last so open()
+    // never sees a half made one
+    auto* h = new(map) ShmRingHeader();
+    h->capacity = capacity;
+    __atomic_store_n(&h->magic, RING_MAGIC, __ATOMIC_RELEASE);
+    return ShmRing(map, size);
+}
+
+ShmRing ShmRing::open(const std::string &name) {
+    int fd = ::shm_open(name.c_str(), O_RDWR, 0);
+    if (fd < 0) {
+        throw errno_error("could not open " + name);
+    }
+    struct stat st{};
+    if (::fstat(fd, &st) != 0) {
+        auto e = errno_error("could not stat " + name);
+        ::close(fd);
+        throw e;
+    }
+    auto size = uint64_t(st.st_size);
+    if (size < DATA_OFFSET + 64) {
+        ::close(fd);
+        throw std::runtime_error(name + " is not a ring");
+    }
+    void* map = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        throw errno_error("could not map " + name);
+    }
+    ShmRing ring(map, size);
+    if (__atomic_load_n(&ring.header->magic, __ATOMIC_ACQUIRE) != RING_MAGIC ||
+        ring.header->capacity != size - DATA_OFFSET) {
+        throw std::runtime_error(name + " is not a ring");
+    }
+    return ring;
+}
+
+void ShmRing::unlink(const std::string &name) {
+    if (::shm_unlink(name.c_str()) != 0) {
+        throw errno_error("could not unlink " + name);
+    }
+}
+
+ShmRing::~ShmRing() {
+    if (header) {
+        ::munmap(header, mapped);
+    }
+}
+
+ShmRing::ShmRing(ShmRing &&o) noexcept
+        : header(o.header), data(o.data), mapped(o.mapped), peeked(o.peeked) {
+    o.header = nullptr;
+    o.data = nullptr;
+}
+
+ShmRing &ShmRing::operator=(ShmRing &&o) noexcept {
+    if (this != &o) {
+        if (header) {
+            ::munmap(header, mapped);
+        }
+        header = o.header;
+        data = o.data;
+        mapped = o.mapped;
+        peeked = o.peeked;
+        o.header = nullptr;
+        o.data = nullptr;
+    }
+    return *this;
+}
+
+uint64_t ShmRing::max_record() const {
+    // with at most half the ring per record, the padding before the wrap is always smaller than
+    // the record, so it fits once the ring drains whatever position head is at
+    return header->capacity / 2 - 8;
+}
+
+bool ShmRing::try_reserve(uint64_t size, Reservation &out) {
+    if (size > max_record()) {
+        throw std::runtime_error("record too large for the ring");
+    }
+    uint64_t cap = header->capacity;
+    uint64_t need = record_size(size);
+    uint64_t head = header->head.load(std::memory_order_relaxed);
+    uint64_t pos, pad;
+    do {
+        uint64_t tail = header->tail.load(std::memory_order_acquire);
+        pos = head & (cap - 1);
+        pad = pos + need > cap ? cap - pos : 0;
+        if (head + pad + need - tail > cap) {
+            return false;
+        }
+    } while (!header->head.compare_exchange_weak(head, head + pad + need, std::memory_order_relaxed));
+
+    if (pad > 0) {
+        __atomic_store_n(reinterpret_cast<uint64_t*>(data + pos), RECORD_PAD | pad, __ATOMIC_RELEASE);
+        pos = 0;
+    }
+    out.word = reinterpret_cast<uint64_t*>(data + pos);
+    out.data = data + pos + 8;
+    out.size = size;
+    return true;
+}
+
+void ShmRing::commit(const Reservation &r) {
+    __atomic_store_n(r.word, RECORD_COMMITTED | r.size, __ATOMIC_RELEASE);
+}
+
+bool ShmRing::try_push(ByteSpan bytes) {
+    Reservation r;
+    if (!try_reserve(bytes.size(), r)) {
+        return false;
+    }
+    if (bytes.size() > 0) {
+        std::memcpy(r.data, bytes.data(), bytes.size());
+    }
+    commit(r);
+    return true;
+}
+
+bool ShmRing::try_push_value(const void *val, const Type &t, uint8_t flags) {
+    const Plan& plan = plan_for(t);
+    flags &= uint8_t(~(FRAME_INTERNED | FRAME_COMPACT_PTR));
+    FrameHeader h;
+    h.flags = flags;
+    h.header_size = frame_header_size(flags);
+    h.body_size = plan.header.size() + plan.size;
+    h.ctx_size = plan_context_size(plan, val); // throws for null pointers before anything is reserved
+    h.fingerprint = plan.fingerprint;
+
+    Reservation r;
+    if (!try_reserve(h.frame_size(), r)) {
+        return false;
+    }
+    std::byte* body = r.data + h.header_size;
+    std::byte* ctx = body + h.body_size;
+    plan_encode_to(plan, val, body, ctx);
+    if (flags & FRAME_CHECKSUM) {
+        h.body_crc = crc32c(0, body, h.body_size);
+        h.ctx_crc = crc32c(0, ctx, h.ctx_size);
+    }
+    put_frame_header(r.data, h);
+    commit(r);
+    return true;
+}
+
+bool ShmRing::try_peek(ByteSpan &out) {
+    uint64_t cap = header->capacity;
+    for (;;) {
+        uint64_t tail = header->tail.load(std::memory_order_relaxed);
+        std::byte* rec = data + (tail & (cap - 1));
+        uint64_t word = __atomic_load_n(reinterpret_cast<uint64_t*>(rec), __ATOMIC_ACQUIRE);
+        if (word == 0) {
+            return false;
+        }
+        if (word & RECORD_PAD) {
+            uint64_t pad = word & RECORD_SIZE_MASK;
+            std::memset(rec, 0, pad);
+            header->tail.store(tail + pad, std::memory_order_release);
+            continue;
+        }
+        uint64_t size = word & RECORD_SIZE_MASK;
+        out = ByteSpan(rec + 8, size);
+        peeked = record_size(size);
+        return true;
+    }
+}
+
+void ShmRing::release() {
+    if (peeked == 0) {
+        throw std::runtime_error("no record to release");
+    }
+    uint64_t tail = header->tail.load(std::memory_order_relaxed);
+    std::memset(data + (tail & (header->capacity - 1)), 0, peeked);
+    header->tail.store(tail + peeked, std::memory_order_release);
+    peeked = 0;
+}
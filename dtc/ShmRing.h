@@ -0,0 +1,105 @@
+#pragma once
+#ifndef DTC_SHMRING_H
+#define DTC_SHMRING_H
+
+#include <atomic>
+#include <string>
+#include "Plan.h"
+#include "View.h"
+
+// a ring buffer of frames in POSIX shared memory, for passing records between processes on the
+// same machine without copying them through a socket or pipe.
+// producers serialize straight into the ring (try_push), the consumer gets each frame as a span
+// inside the mapping (try_peek) and reads it in place with open_view, the View's context is the
+// frame's context in the mapping. nothing is copied on either side besides the serialization itself.
+// any number of producers (threads or processes), one consumer. the indexes are lock-free atomics
+// in the mapping, nobody ever blocks: try_* return false when the ring is full / empty.
+
+// Ring layout:
+//  - header: magic, capacity, then the head and tail indexes (u64 each, on their own cache lines)
+//  - data: capacity bytes of records, each one 8-byte aligned:
+//     - word: u64, 0 while the record isn't committed, then RECORD_COMMITTED | payload size,
+//       or RECORD_PAD | size for the unused end of the data when a record didn't fit before the wrap
+//     - payload, padded to 8 bytes
+// the indexes only grow, position in the data is index % capacity. the data past tail and before
+// head is always zero (the consumer clears what it releases), so an uncommitted word reads as 0.
+
+struct ShmRingHeader {
+    uint64_t magic = 0;
+    uint64_t capacity = 0;
+    alignas(64) std::atomic<uint64_t> head{0}; // end of the space producers reserved
+    alignas(64) std::atomic<uint64_t> tail{0}; // end of the space the consumer released
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "the ring needs lock-free 64-bit atomics");
+
+struct ShmRing {
+    // space a producer reserved, write size bytes to data then commit it
+    struct Reservation {
+        std::byte* data = nullptr;
+        uint64_t size = 0;
+        uint64_t* word = nullptr;
+    };
+
+    // creates a new shared memory object (fails if name exists) with capacity bytes of data,
+    // capacity is a power of two of at least 64
+    static ShmRing create(const std::string& name, uint64_t capacity);
+
+    // maps a ring another process created
+    static ShmRing open(const std::string& name);
+
+    // removes the name, mappings that already exist stay valid
+    static void unlink(const std::string& name);
+
+    ShmRing() = default;
+    ~ShmRing();
+    ShmRing(ShmRing&& o) noexcept;
+    ShmRing& operator=(ShmRing&& o) noexcept;
+    ShmRing(const ShmRing&) = delete;
+    ShmRing& operator=(const ShmRing&) = delete;
+
+    // the largest payload that will ever fit (a record can take up to half the ring)
+    [[nodiscard]] uint64_t max_record() const;
+
+    // producer side, any thread or process
+
+    // reserves size bytes, false if the ring is too full right now. throws if size can never fit.
+    // the consumer stops at a reserved record until it's committed, so commit soon
+    bool try_reserve(uint64_t size, Reservation& out);
+    void commit(const Reservation& r);
+
+    // copies bytes in as one record
+    bool try_push(ByteSpan bytes);
+
+    // serializes val into a frame right inside the ring, without a buffer in between.
+    // strings aren't interned and pointers aren't compact (FRAME_INTERNED and FRAME_COMPACT_PTR are
+    // dropped from flags), so the consumer can open_view it
+    bool try_push_value(const void* val, const Type& t, uint8_t flags=FRAME_SIZED | FRAME_FINGERPRINT);
+
+    template<typename T>
+    bool try_push(const T& val, const Type& t, uint8_t flags=FRAME_SIZED | FRAME_FINGERPRINT) {
+        if (sizeof(T) != plan_for(t).size) {
+            throw std::runtime_error("primitive type size mismatch");
+        }
+        return try_push_value(&val, t, flags);
+    }
+
+    // consumer side, one thread only
+
+    // the oldest committed record, false if there is none. it stays in the ring (and out stays
+    // valid) until release(), peeking again before that returns the same record
+    bool try_peek(ByteSpan& out);
+
+    // frees the record try_peek returned
+    void release();
+
+private:
+    ShmRingHeader* header = nullptr;
+    std::byte* data = nullptr;
+    uint64_t mapped = 0;
+    uint64_t peeked = 0; // bytes the peeked record takes, 0 if there isn't one
+
+    ShmRing(void* map, uint64_t size);
+};
+
+#endif //DTC_SHMRING_H
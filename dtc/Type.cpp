@@ -1,4 +1,5 @@
 #include "Type.h"
+#include "Visit.h"
 
 BasicType::BasicType(bool sign, uint64_t bytes) : sign(sign), bytes(bytes) {}
 
@@ -8,31 +9,109 @@ StructType::StructType(std::vector<Type> types) : types(std::move(types)) {}
 
 StructType::StructType(std::initializer_list<Type> types) : types(types) {}
 
+SliceType::SliceType(const Type& element, bool string) : element(std::make_shared<const Type>(element)), string(string) {}
+
+ArrayType::ArrayType(const Type& element, uint64_t count) : element(std::make_shared<const Type>(element)), count(count) {}
+
+UnionType::UnionType(std::vector<Type> types) : types(std::move(types)) {}
+
+const Type& ArrayType::elem() const {
+    if (!element) {
+        throw std::runtime_error("array has no element type");
+    }
+    return *element;
+}
+
+const Type& SliceType::elem() const {
+    if (!element) {
+        throw std::runtime_error("slice has no element type");
+    }
+    return *element;
+}
+
 Type::Type(BasicType type, uint64_t deref) : type(type), deref_count(deref) {}
 
-Type::Type(StructType type, uint64_t deref) : type(type), deref_count(deref) {}
+Type::Type(StructType type, uint64_t deref) : type(std::move(type)), deref_count(deref) {}
+
+Type::Type(SliceType type, uint64_t deref) : type(std::move(type)), deref_count(deref) {}
+
+Type::Type(ArrayType type, uint64_t deref) : type(std::move(type)), deref_count(deref) {}
+
+Type::Type(UnionType type, uint64_t deref) : type(std::move(type)), deref_count(deref) {}
 
 Type::Type(std::initializer_list<Type> types, uint64_t deref) : type(StructType(types)), deref_count(deref) {}
 
+namespace {
+
+// compares the alternative of a type against other's, which is known to be the same kind
+struct SameAs {
+    const Type& other;
+
+    bool on_basic(const Type&, const BasicType& b) const {
+        auto& b2 = *std::get_if<BasicType>(&other.type);
+        // floats have no unsigned kind, their sign flag isn't serialized or fingerprinted either
+        return (b.floating || b.sign == b2.sign) && b.bytes == b2.bytes && b.floating == b2.floating;
+    }
+
+    bool on_struct(const Type&, const StructType& s) const {
+        return s.types == std::get_if<StructType>(&other.type)->types;
+    }
+
+    bool on_slice(const Type&, const SliceType& sl) const {
+        auto& sl2 = *std::get_if<SliceType>(&other.type);
+        return sl.string == sl2.string && sl.elem() == sl2.elem();
+    }
+
+    bool on_array(const Type&, const ArrayType& a) const {
+        auto& a2 = *std::get_if<ArrayType>(&other.type);
+        return a.count == a2.count && a.elem() == a2.elem();
+    }
+
+    bool on_union(const Type&, const UnionType& u) const {
+        return u.types == std::get_if<UnionType>(&other.type)->types;
+    }
+};
+
+} // namespace
+
 bool Type::operator==(const Type &other) const {
     if (deref_count != other.deref_count) return false;
     if (type.index() != other.type.index()) return false;
-    if (auto b = std::get_if<BasicType>(&type)) {
-        if (auto b2 = std::get_if<BasicType>(&other.type)) {
-            return b->sign == b2->sign && b->bytes == b2->bytes && b->floating == b2->floating;
-        }
-        return false;
-    } else if (auto s = std::get_if<StructType>(&type)) {
-        if (auto s2 = std::get_if<StructType>(&other.type)) {
-            if (s->types.size() != s2->types.size()) return false;
-            for (size_t i = 0; i < s->types.size(); i++) {
-                if (s->types[i] != s2->types[i]) return false;
+    return visit_kind(*this, SameAs{other});
+}
+
+static uint64_t fp_mix(uint64_t h, uint64_t v) {
+    // splitmix64 finalizer over a boost-style combine
+    uint64_t z = h ^ (v + 0x9e3779b97f4a7c15 + (h << 6) + (h >> 2));
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+    return z ^ (z >> 31);
+}
+
+uint64_t Type::fingerprint() const {
+    uint64_t shape = type.shape_fingerprint.value.load(std::memory_order_relaxed);
+    if (shape == 0) {
+        if (auto b = std::get_if<BasicType>(&type)) {
+            shape = fp_mix(fp_mix(0, b->floating ? 2 : (b->sign ? 1 : 0)), b->bytes);
+        } else if (auto s = std::get_if<StructType>(&type)) {
+            shape = fp_mix(1, s->types.size());
+            for (auto& tp : s->types) {
+                shape = fp_mix(shape, tp.fingerprint());
+            }
+        } else if (auto sl = std::get_if<SliceType>(&type)) {
+            shape = fp_mix(fp_mix(2, sl->string ? 1 : 0), sl->elem().fingerprint());
+        } else if (auto a = std::get_if<ArrayType>(&type)) {
+            shape = fp_mix(fp_mix(3, a->count), a->elem().fingerprint());
+        } else if (auto u = std::get_if<UnionType>(&type)) {
+            shape = fp_mix(4, u->types.size());
+            for (auto& tp : u->types) {
+                shape = fp_mix(shape, tp.fingerprint());
             }
-            return true;
         }
-        return false;
+        shape |= 1; // never 0, that means not computed
+        type.shape_fingerprint.value.store(shape, std::memory_order_relaxed);
     }
-    return false;
+    return fp_mix(shape, deref_count);
 }
 
 bool Type::operator!=(const Type &other) const {
@@ -55,17 +134,165 @@ Type new_struct_type(std::vector<Type> types) {
     return Type(StructType(std::move(types)));
 }
 
-uint64_t t_sizeof(Type t) {
-    if (t.deref_count > 0) {
+Type new_slice_type(const Type& element) {
+    return Type(SliceType(element));
+}
+
+Type new_array_type(const Type& element, uint64_t count) {
+    return Type(ArrayType(element, count));
+}
+
+Type new_union_type(std::vector<Type> types) {
+    return Type(UnionType(std::move(types)));
+}
+
+namespace {
+
+struct SizeOf {
+    uint64_t on_pointer(const Type&) {
         return sizeof(void*);
-    } else if (auto b = std::get_if<BasicType>(&t.type)) {
-        return b->bytes;
-    } else if (auto s = std::get_if<StructType>(&t.type)) {
+    }
+
+    uint64_t on_basic(const Type&, const BasicType& b) {
+        return b.bytes;
+    }
+
+    uint64_t on_struct(const Type&, const StructType& s) {
         uint64_t size = 0;
-        for (auto& tp : s->types) {
-            size += t_sizeof(tp);
+        for (auto& tp : s.types) {
+            size += visit_type(tp, *this);
         }
         return size;
     }
-    return 0;
+
+    uint64_t on_slice(const Type&, const SliceType&) {
+        return sizeof(void*) + 8;
+    }
+
+    uint64_t on_array(const Type&, const ArrayType& a) {
+        return visit_type(a.elem(), *this) * a.count;
+    }
+
+    uint64_t on_union(const Type&, const UnionType& u) {
+        uint64_t size = 0;
+        for (auto& tp : u.types) {
+            size = std::max(size, visit_type(tp, *this));
+        }
+        return 4 + size; // the tag, then room for the largest member
+    }
+};
+
+} // namespace
+
+uint64_t t_sizeof(const Type& t) {
+    return visit_type(t, SizeOf{});
+}
+
+// the type of field index inside t, and its offset
+static const Type& step_field(const Type& t, uint64_t index, uint64_t& offset) {
+    if (t.deref_count == 0) {
+        if (auto s = std::get_if<StructType>(&t.type)) {
+            if (index >= s->types.size()) {
+                throw std::runtime_error("Index out of bounds");
+            }
+            for (uint64_t j = 0; j < index; j++) {
+                offset += t_sizeof(s->types[j]);
+            }
+            return s->types[index];
+        }
+        if (auto a = std::get_if<ArrayType>(&t.type)) {
+            if (index >= a->count) {
+                throw std::runtime_error("Index out of bounds");
+            }
+            offset += index * t_sizeof(a->elem());
+            return a->elem();
+        }
+        if (auto u = std::get_if<UnionType>(&t.type)) {
+            if (index >= u->types.size()) {
+                throw std::runtime_error("Index out of bounds");
+            }
+            offset += 4;
+            return u->types[index];
+        }
+    }
+    throw std::runtime_error("field path goes through a non-struct type");
+}
+
+const Type& t_field(const Type& t, const FieldPath& path) {
+    const Type* cur = &t;
+    uint64_t offset = 0;
+    for (uint64_t index : path) {
+        cur = &step_field(*cur, index, offset);
+    }
+    return *cur;
+}
+
+uint64_t t_offsetof(const Type& t, const FieldPath& path) {
+    const Type* cur = &t;
+    uint64_t offset = 0;
+    for (uint64_t index : path) {
+        cur = &step_field(*cur, index, offset);
+    }
+    return offset;
+}
+
+static void collect_pointer_offsets(const Type& t, uint64_t base, std::vector<uint64_t>& out) {
+    if (t.deref_count > 0 || t.is_slice()) {
+        out.push_back(base);
+    } else if (auto s = std::get_if<StructType>(&t.type)) {
+        for (auto& tp : s->types) {
+            collect_pointer_offsets(tp, base, out);
+            base += t_sizeof(tp);
+        }
+    } else if (auto a = std::get_if<ArrayType>(&t.type)) {
+        if (a->count == 0) {
+            return; // no elements, so none of their slots exist
+        }
+        size_t first = out.size();
+        collect_pointer_offsets(a->elem(), base, out);
+        size_t per_element = out.size() - first;
+        uint64_t stride = t_sizeof(a->elem());
+        for (uint64_t i = 1; i < a->count && per_element > 0; i++) {
+            for (size_t k = 0; k < per_element; k++) {
+                out.push_back(out[first + k] + i * stride);
+            }
+        }
+    } else if (t.is_union() && t_has_pointers(t)) {
+        throw std::runtime_error("union pointers depend on the tag, they have no fixed offsets");
+    }
+}
+
+std::vector<uint64_t> t_pointer_offsets(const Type& t) {
+    std::vector<uint64_t> offsets;
+    collect_pointer_offsets(t, 0, offsets);
+    return offsets;
+}
+
+bool t_has_pointers(const Type& t) {
+    if (t.deref_count > 0 || t.is_slice()) {
+        return true;
+    }
+    if (auto s = std::get_if<StructType>(&t.type)) {
+        return std::any_of(s->types.begin(), s->types.end(), t_has_pointers);
+    }
+    if (auto a = std::get_if<ArrayType>(&t.type)) {
+        return a->count > 0 && t_has_pointers(a->elem());
+    }
+    if (auto u = std::get_if<UnionType>(&t.type)) {
+        return std::any_of(u->types.begin(), u->types.end(), t_has_pointers);
+    }
+    return false;
+}
+
+bool t_has_union(const Type& t) {
+    if (t.deref_count > 0) {
+        return false;
+    }
+    if (auto s = std::get_if<StructType>(&t.type)) {
+        return std::any_of(s->types.begin(), s->types.end(), t_has_union);
+    }
+    if (auto a = std::get_if<ArrayType>(&t.type)) {
+        return a->count > 0 && t_has_union(a->elem());
+    }
+    return t.is_union();
 }
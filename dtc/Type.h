@@ -10,6 +10,9 @@
 #include <iostream>
 #include <algorithm>
 #include <cstring>
+#include <cstddef>
+#include <atomic>
+#include <memory>
 
 
 struct BasicType {
@@ -31,14 +34,96 @@ struct StructType {
     StructType(std::initializer_list<Type> types);
     ~StructType() = default;
 };
+// a pointer plus an element count, laid out in memory as { element* ptr; u64 count; }
+// the count is serialized with it, so nobody has to scan for the length.
+// a string slice is a slice of u8 whose characters are followed by a terminator in the context
+// (count doesn't include it), so ptr can still be used as a C string after deserializing
+struct SliceType {
+    std::shared_ptr<const Type> element{};
+    bool string = false;
+
+    SliceType() = default;
+    explicit SliceType(const Type& element, bool string=false);
+    ~SliceType() = default;
+
+    [[nodiscard]] const Type& elem() const;
+};
+
+// count elements stored back to back, like int[1024]. the whole array is one node in the type
+// (and in its serialized header), and values without pointers are copied in one go
+struct ArrayType {
+    std::shared_ptr<const Type> element{};
+    uint64_t count = 0;
+
+    ArrayType() = default;
+    ArrayType(const Type& element, uint64_t count);
+    ~ArrayType() = default;
+
+    [[nodiscard]] const Type& elem() const;
+};
+
+// a tagged union, laid out in memory as { u32 tag; <largest member> } with no padding, like a packed
+// struct holding a C union. the tag is the index of the active member. only the tag and the active
+// member's bytes are serialized, so a record doesn't pay for the members it isn't using
+struct UnionType {
+    std::vector<Type> types{};
+
+    UnionType() = default;
+    explicit UnionType(std::vector<Type> types);
+    ~UnionType() = default;
+};
+
+// a lazily computed value that can be filled in from several threads, copies keep it
+struct CachedU64 {
+    mutable std::atomic<uint64_t> value{0}; // 0 = not computed yet
+
+    CachedU64() = default;
+    CachedU64(const CachedU64& other) : value(other.value.load(std::memory_order_relaxed)) {}
+    CachedU64& operator=(const CachedU64& other) {
+        value.store(other.value.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        return *this;
+    }
+
+    void clear() {
+        value.store(0, std::memory_order_relaxed);
+    }
+};
+
+// the kind of a type, with the fingerprint of it (without the deref count) cached next to it.
+// a copy keeps the cache, assigning or emplacing a new alternative clears it
+struct TypeVariant : std::variant<BasicType, StructType, SliceType, ArrayType, UnionType> {
+    using Base = std::variant<BasicType, StructType, SliceType, ArrayType, UnionType>;
+    using Base::Base;
+
+    CachedU64 shape_fingerprint{};
+
+    TypeVariant() = default;
+
+    template<typename T, typename = std::enable_if_t<!std::is_same_v<std::decay_t<T>, TypeVariant>>>
+    TypeVariant& operator=(T&& alternative) {
+        Base::operator=(std::forward<T>(alternative));
+        shape_fingerprint.clear();
+        return *this;
+    }
+
+    template<typename T, typename... Args>
+    T& emplace(Args&&... args) {
+        shape_fingerprint.clear();
+        return Base::emplace<T>(std::forward<Args>(args)...);
+    }
+};
+
 struct Type {
     uint64_t deref_count = 0;
-    std::variant<BasicType, StructType> type{};
+    TypeVariant type{};
     bool sanitized = false;
 
     Type() = default;
     explicit Type(BasicType type, uint64_t deref=0);
     explicit Type(StructType type, uint64_t deref=0);
+    explicit Type(SliceType type, uint64_t deref=0);
+    explicit Type(ArrayType type, uint64_t deref=0);
+    explicit Type(UnionType type, uint64_t deref=0);
     Type(std::initializer_list<Type> types, uint64_t deref=0);
 
     ~Type() = default;
@@ -55,8 +140,26 @@ struct Type {
         return std::holds_alternative<StructType>(type);
     }
 
+    inline bool is_slice() const {
+        return std::holds_alternative<SliceType>(type);
+    }
+
+    inline bool is_array() const {
+        return std::holds_alternative<ArrayType>(type);
+    }
+
+    inline bool is_union() const {
+        return std::holds_alternative<UnionType>(type);
+    }
+
     Type ptr() const;
     Type deref() const;
+
+    // canonical 64-bit hash of the structure (sign/float/size of every basic type, struct
+    // nesting and deref counts), equal types always have equal fingerprints.
+    // computed once and cached in `type`, assigning a new `type` clears it. changing the members of
+    // an alternative in place (through get_if) doesn't, build a new one and assign that instead
+    [[nodiscard]] uint64_t fingerprint() const;
 };
 
 const auto t_i8 = Type(BasicType(true, 1));
@@ -72,6 +175,7 @@ const auto t_f64 = Type(BasicType(8, true));
 const auto t_bool = Type(BasicType(false, 1));
 const auto t_voidptr = Type(BasicType(false, 0), 1);
 const auto t_str = Type(BasicType(false, 1), 1);
+const auto t_strslice = Type(SliceType(t_u8, true));
 
 
 typedef int8_t i8;
@@ -86,6 +190,31 @@ typedef float f32;
 typedef double f64;
 
 Type new_struct_type(std::vector<Type> types);
+Type new_slice_type(const Type& element);
+Type new_array_type(const Type& element, uint64_t count);
+Type new_union_type(std::vector<Type> types);
+
+uint64_t t_sizeof(const Type& t);
+
+// a field inside nested structs and arrays, {2, 1} is field (or element) 1 of field 2
+typedef std::vector<uint64_t> FieldPath;
+
+// the type of the field at path, paths can't go through pointers.
+// in a union, the index picks a member (whether or not it's the active one)
+const Type& t_field(const Type& t, const FieldPath& path);
+
+// byte offset of the field at path from the start of a value of type t
+uint64_t t_offsetof(const Type& t, const FieldPath& path);
+
+// byte offsets of every pointer slot in a value of type t, including the pointer half of
+// slices (pointees are not followed).
+// throws for a type with a union, where the slots depend on the tags
+std::vector<uint64_t> t_pointer_offsets(const Type& t);
+
+// true if a value of type t has pointer or slice slots (in any member of its unions)
+bool t_has_pointers(const Type& t);
 
-uint64_t t_sizeof(Type t);
+// true if a value of type t has a union in it (not behind a pointer), so it's serialized smaller
+// than t_sizeof and at a size that depends on the tags
+bool t_has_union(const Type& t);
 #endif //DTC_TYPE_H
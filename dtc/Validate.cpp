@@ -0,0 +1,312 @@
+#include "Validate.h"
+
+const char *status_string(Status s) {
+    switch (s) {
+        case Status::Ok: return "ok";
+        case Status::Truncated: return "truncated";
+        case Status::UnknownFlags: return "unknown frame flags";
+        case Status::BadType: return "bad type";
+        case Status::TypeMismatch: return "type mismatch";
+        case Status::SizeMismatch: return "size mismatch";
+        case Status::BadPointer: return "pointer outside the context";
+        case Status::Unterminated: return "unterminated string";
+        case Status::BadChecksum: return "checksum mismatch";
+    }
+    return "unknown status";
+}
+
+namespace {
+
+// deserialize_type with every read bounds checked, and the value size worked out on the way
+struct TypeReader {
+    const std::byte* p;
+    uint64_t size;
+    const ValidateLimits& limits;
+    uint64_t pos = 0;
+    uint64_t types = 0;
+
+    bool read_u8(uint8_t& v) {
+        if (size - pos < 1) {
+            return false;
+        }
+        v = std::to_integer<uint8_t>(p[pos++]);
+        return true;
+    }
+
+    bool read_u64(uint64_t& v) {
+        if (size - pos < 8) {
+            return false;
+        }
+        v = deserialize_u64(p + pos);
+        pos += 8;
+        return true;
+    }
+
+    Status read(Type& t, uint64_t& value_size, uint64_t depth) {
+        if (depth > limits.max_depth || ++types > limits.max_types) {
+            return Status::BadType;
+        }
+        uint8_t typetype = 0;
+        if (!read_u64(t.deref_count) || !read_u8(typetype)) {
+            return Status::Truncated;
+        }
+        if (t.deref_count > limits.max_depth) {
+            return Status::BadType;
+        }
+        if (typetype == 0) {
+            uint8_t flags = 0;
+            BasicType b;
+            if (!read_u8(flags) || !read_u64(b.bytes)) {
+                return Status::Truncated;
+            }
+            if (flags > 2) {
+                return Status::BadType;
+            }
+            b.floating = flags == 2;
+            b.sign = flags == 1;
+            t.type = b;
+            value_size = b.bytes;
+        } else if (typetype == 1) {
+            uint64_t n = 0;
+            if (!read_u64(n)) {
+                return Status::Truncated;
+            }
+            if (n > limits.max_types - types) {
+                return Status::BadType;
+            }
+            if (n > (size - pos) / 17) {
+                return Status::Truncated; // the smallest type (an empty struct) is 17 bytes
+            }
+            StructType s;
+            s.types.resize(n);
+            value_size = 0;
+            for (auto& field : s.types) {
+                uint64_t field_size = 0;
+                Status st = read(field, field_size, depth + 1);
+                if (st != Status::Ok) {
+                    return st;
+                }
+                if (field_size > limits.max_value_size - value_size) {
+                    return Status::BadType;
+                }
+                value_size += field_size;
+            }
+            t.type = std::move(s);
+        } else if (typetype == 2) {
+            uint8_t flags = 0;
+            if (!read_u8(flags)) {
+                return Status::Truncated;
+            }
+            if (flags > 1) {
+                return Status::BadType;
+            }
+            Type element;
+            uint64_t element_size = 0;
+            Status st = read(element, element_size, depth + 1);
+            if (st != Status::Ok) {
+                return st;
+            }
+            t.type = SliceType(element, flags == 1);
+            value_size = sizeof(void*) + 8;
+        } else if (typetype == 3) {
+            uint64_t count = 0;
+            if (!read_u64(count)) {
+                return Status::Truncated;
+            }
+            Type element;
+            uint64_t element_size = 0;
+            Status st = read(element, element_size, depth + 1);
+            if (st != Status::Ok) {
+                return st;
+            }
+            if (element_size != 0 && count > limits.max_value_size / element_size) {
+                return Status::BadType;
+            }
+            t.type = ArrayType(element, count);
+            value_size = element_size * count;
+        } else {
+            return Status::BadType;
+        }
+        if (t.deref_count > 0) {
+            value_size = sizeof(void*);
+        }
+        return value_size > limits.max_value_size ? Status::BadType : Status::Ok;
+    }
+};
+
+bool is_string_pointee(const Type& t) {
+    auto b = std::get_if<BasicType>(&t.type);
+    return t.deref_count == 0 && b && b->bytes == 1 && !b->sign && !b->floating;
+}
+
+// a pointer or slice in the value
+struct Slot {
+    uint64_t offset = 0;
+    const Type* type = nullptr;
+};
+
+// the slots of a value of type t at offset, in t_pointer_offsets order. an array's element is only
+// walked once and its slots repeated for every element, so the work is the number of slots, and
+// that's capped by limits.max_pointers (an array of elements without slots costs nothing)
+Status collect_slots(const Type& t, uint64_t offset, const ValidateLimits& limits, std::vector<Slot>& out) {
+    if (t.deref_count > 0 || t.is_slice()) {
+        if (out.size() >= limits.max_pointers) {
+            return Status::BadType;
+        }
+        out.push_back(Slot{offset, &t});
+        return Status::Ok;
+    }
+    if (auto s = std::get_if<StructType>(&t.type)) {
+        for (auto& field : s->types) {
+            Status st = collect_slots(field, offset, limits, out);
+            if (st != Status::Ok) {
+                return st;
+            }
+            offset += t_sizeof(field);
+        }
+        return Status::Ok;
+    }
+    if (auto a = std::get_if<ArrayType>(&t.type)) {
+        uint64_t size = t_sizeof(a->elem());
+        if (a->count == 0 || size == 0) {
+            return Status::Ok;
+        }
+        size_t first = out.size();
+        Status st = collect_slots(a->elem(), offset, limits, out);
+        if (st != Status::Ok) {
+            return st;
+        }
+        uint64_t per_element = out.size() - first;
+        if (per_element == 0) {
+            return Status::Ok;
+        }
+        if (a->count - 1 > (limits.max_pointers - out.size()) / per_element) {
+            return Status::BadType;
+        }
+        for (uint64_t i = 1; i < a->count; i++) {
+            for (size_t k = 0; k < per_element; k++) {
+                out.push_back(Slot{out[first + k].offset + i * size, out[first + k].type});
+            }
+        }
+    }
+    return Status::Ok;
+}
+
+// checks the pointer or slice at data lands inside ctx
+Status check_slot(const Type& t, const std::byte* data, ByteSpan ctx) {
+    if (t.deref_count > 0) {
+        // only the first level is checked, that's all decoding relocates
+        Type pointee = t.deref();
+        uint64_t ptr = deserialize_u64(data);
+        uint64_t need = t_sizeof(pointee);
+        if (ptr > ctx.size() || ctx.size() - ptr < need) {
+            return Status::BadPointer;
+        }
+        if (is_string_pointee(pointee) && std::memchr(ctx.data() + ptr, 0, ctx.size() - ptr) == nullptr) {
+            return Status::Unterminated;
+        }
+        return Status::Ok;
+    }
+    auto& sl = std::get<SliceType>(t.type);
+    uint64_t ptr = deserialize_u64(data);
+    uint64_t count = deserialize_u64(data + sizeof(void*));
+    uint64_t element_size = t_sizeof(sl.elem());
+    if (element_size != 0 && count > ctx.size() / element_size) {
+        return Status::BadPointer;
+    }
+    uint64_t need = element_size * count + (sl.string ? 1 : 0);
+    if (ptr > ctx.size() || ctx.size() - ptr < need) {
+        return Status::BadPointer;
+    }
+    if (sl.string && ctx[ptr + need - 1] != std::byte(0)) {
+        return Status::Unterminated;
+    }
+    return Status::Ok;
+}
+
+Status validate(ByteSpan frame, const Type* expected, ValidFrame& out, const ValidateLimits& limits) {
+    out = ValidFrame{};
+    out.frame = frame;
+    if (!parse_frame_header(frame, out.header)) {
+        return Status::Truncated;
+    }
+    const FrameHeader& h = out.header;
+    if (h.flags & ~FRAME_KNOWN_FLAGS) {
+        return Status::UnknownFlags;
+    }
+    if (expected && (h.flags & FRAME_FINGERPRINT) && h.fingerprint != expected->fingerprint()) {
+        return Status::TypeMismatch; // rejected without parsing anything
+    }
+
+    ByteSpan body = frame.subspan(h.header_size, h.body_size);
+    ByteSpan ctx = frame.subspan(h.header_size + h.body_size, h.ctx_size);
+    TypeReader reader{body.data(), body.size(), limits};
+    Status st = reader.read(out.type, out.value_size, 0);
+    if (st != Status::Ok) {
+        return st;
+    }
+    out.type_size = reader.pos;
+    uint64_t fingerprint = out.type.fingerprint();
+    if ((h.flags & FRAME_FINGERPRINT) && h.fingerprint != fingerprint) {
+        return Status::TypeMismatch;
+    }
+    if (expected && fingerprint != expected->fingerprint()) {
+        return Status::TypeMismatch;
+    }
+    std::vector<Slot> slots;
+    st = collect_slots(out.type, 0, limits, slots);
+    if (st != Status::Ok) {
+        return st;
+    }
+    out.pointers.reserve(slots.size());
+    for (const Slot& slot : slots) {
+        out.pointers.push_back(slot.offset);
+    }
+    const std::byte* value = body.data() + out.type_size;
+    if (h.flags & FRAME_COMPACT_PTR) {
+        // checked like any other value once it's widened
+        if (body.size() - out.type_size != out.value_size - out.pointers.size() * 4) {
+            return Status::SizeMismatch;
+        }
+        out.wide.resize(out.value_size);
+        widen_pointers(value, out.wide.data(), out.value_size, out.pointers);
+        value = out.wide.data();
+    } else if (body.size() - out.type_size != out.value_size) {
+        return Status::SizeMismatch;
+    }
+
+    for (const Slot& slot : slots) {
+        st = check_slot(*slot.type, value + slot.offset, ctx);
+        if (st != Status::Ok) {
+            return st;
+        }
+    }
+    if ((h.flags & FRAME_CHECKSUM) &&
+        (crc32c(0, body.data(), body.size()) != h.body_crc || crc32c(0, ctx.data(), ctx.size()) != h.ctx_crc)) {
+        return Status::BadChecksum;
+    }
+    return Status::Ok;
+}
+
+}
+
+Status validate_frame(ByteSpan frame, ValidFrame &out, const ValidateLimits &limits) {
+    return validate(frame, nullptr, out, limits);
+}
+
+Status validate_frame(ByteSpan frame, const Type &expected, ValidFrame &out, const ValidateLimits &limits) {
+    return validate(frame, &expected, out, limits);
+}
+
+void decode_unchecked(const ValidFrame &v, Context &ctx, void *out) {
+    const std::byte* body = v.frame.data() + v.header.header_size;
+    const std::byte* ctx_src = body + v.header.body_size;
+    ctx.assign(ctx_src, ctx_src + v.header.ctx_size);
+    ctx.strings.clear();
+    auto* dst = static_cast<std::byte*>(out);
+    std::memcpy(dst, (v.header.flags & FRAME_COMPACT_PTR) ? v.wide.data() : body + v.type_size, v.value_size);
+    for (uint64_t off : v.pointers) {
+        const std::byte* real = ctx.data() + deserialize_u64(dst + off);
+        std::memcpy(dst + off, &real, sizeof(void*));
+    }
+}
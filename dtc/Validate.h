@@ -0,0 +1,74 @@
+#pragma once
+#ifndef DTC_VALIDATE_H
+#define DTC_VALIDATE_H
+
+#include "Serial.h"
+
+// decoding untrusted frames in two steps.
+// validate_frame checks the whole frame once: the header sections fit in the buffer, the type
+// header parses within the limits, the body is exactly that type's size, every pointer and slice
+// lands inside the context (strings terminated inside it) and the checksums match.
+// decode_unchecked then does no checks at all, it's a copy of the context, a memcpy of the value
+// and a pass over the pointer slots the validator collected.
+// nothing here throws for bad input, problems come back as a Status.
+// types with unions don't have the fixed layout this relies on, their frames come back as BadType
+
+enum class Status : uint8_t {
+    Ok,
+    Truncated,      // a size or offset points past the end of the buffer
+    UnknownFlags,   // frame flags this version doesn't know (written by a newer one, or corrupt)
+    BadType,        // the type header doesn't parse, or goes past the limits
+    TypeMismatch,   // a valid type, but not the expected one
+    SizeMismatch,   // the body isn't the size of its type
+    BadPointer,     // a pointer or slice outside the context
+    Unterminated,   // a string with no terminator inside the context
+    BadChecksum,
+};
+
+const char* status_string(Status s);
+
+struct ValidateLimits {
+    uint64_t max_depth = 64; // nesting of structs, slices, arrays and derefs
+    uint64_t max_types = uint64_t(1) << 16; // type nodes in the header
+    uint64_t max_value_size = uint64_t(1) << 32;
+    uint64_t max_pointers = uint64_t(1) << 20; // pointer and slice slots in the value
+};
+
+// what validate_frame found, only meaningful if it returned Status::Ok.
+// it points into the validated buffer, so the buffer has to outlive it
+struct ValidFrame {
+    ByteSpan frame{};
+    FrameHeader header{};
+    Type type{};
+    uint64_t type_size = 0; // the type header at the start of the body
+    uint64_t value_size = 0;
+    std::vector<uint64_t> pointers{}; // pointer slots of the value, like t_pointer_offsets(type)
+    Bytes wide{}; // for FRAME_COMPACT_PTR frames, the value with its pointers widened
+};
+
+Status validate_frame(ByteSpan frame, ValidFrame& out, const ValidateLimits& limits={});
+
+// also checks the value is of type expected
+Status validate_frame(ByteSpan frame, const Type& expected, ValidFrame& out, const ValidateLimits& limits={});
+
+// decodes a frame validate_frame accepted into out (value_size bytes), pointing into ctx (which is replaced).
+// no checks: calling it with anything else is undefined behaviour
+void decode_unchecked(const ValidFrame& v, Context& ctx, void* out);
+
+// validate_frame + decode_unchecked. out and ctx are left alone unless this returns Status::Ok
+template<typename T>
+Status try_final_deserialize(ByteSpan frame, const Type& expected, T& out, Context& ctx,
+                             const ValidateLimits& limits={}) {
+    ValidFrame v;
+    Status s = validate_frame(frame, expected, v, limits);
+    if (s != Status::Ok) {
+        return s;
+    }
+    if (v.value_size != sizeof(T)) {
+        return Status::SizeMismatch;
+    }
+    decode_unchecked(v, ctx, &out);
+    return Status::Ok;
+}
+
+#endif //DTC_VALIDATE_H
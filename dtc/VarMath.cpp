@@ -14,7 +14,7 @@
 // ex u8 + u32 = u32
 // ...
 
-Variable var_add_i(Variable a, Variable b) {
+Variable var_add_i(const Variable& a, const Variable& b) {
     if (a.is_basic() && b.is_basic()) {
         auto a2 = std::get<BasicType>(a.type.type);
         auto b2 = std::get<BasicType>(b.type.type);
@@ -45,7 +45,7 @@ Variable var_add_i(Variable a, Variable b) {
     }
 }
 
-Variable var_sub_i(Variable a, Variable b) {
+Variable var_sub_i(const Variable& a, const Variable& b) {
     if (a.is_basic() && b.is_basic()) {
         auto a2 = std::get<BasicType>(a.type.type);
         auto b2 = std::get<BasicType>(b.type.type);
@@ -76,7 +76,7 @@ Variable var_sub_i(Variable a, Variable b) {
     }
 }
 
-Variable var_mul_i(Variable a, Variable b) {
+Variable var_mul_i(const Variable& a, const Variable& b) {
     if (a.is_basic() && b.is_basic()) {
         auto a2 = std::get<BasicType>(a.type.type);
         auto b2 = std::get<BasicType>(b.type.type);
@@ -107,7 +107,7 @@ Variable var_mul_i(Variable a, Variable b) {
     }
 }
 
-Variable var_div_i(Variable a, Variable b) {
+Variable var_div_i(const Variable& a, const Variable& b) {
     if (a.is_basic() && b.is_basic()) {
         auto a2 = std::get<BasicType>(a.type.type);
         auto b2 = std::get<BasicType>(b.type.type);
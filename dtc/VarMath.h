@@ -4,17 +4,17 @@
 
 #include "Variable.h"
 
-Variable var_add_i(Variable a, Variable b);
-Variable var_sub_i(Variable a, Variable b);
-Variable var_mul_i(Variable a, Variable b);
-Variable var_div_i(Variable a, Variable b);
+Variable var_add_i(const Variable& a, const Variable& b);
+Variable var_sub_i(const Variable& a, const Variable& b);
+Variable var_mul_i(const Variable& a, const Variable& b);
+Variable var_div_i(const Variable& a, const Variable& b);
 
-Variable var_add_f(Variable a, Variable b);
-Variable var_sub_f(Variable a, Variable b);
-Variable var_mul_f(Variable a, Variable b);
-Variable var_div_f(Variable a, Variable b);
+Variable var_add_f(const Variable& a, const Variable& b);
+Variable var_sub_f(const Variable& a, const Variable& b);
+Variable var_mul_f(const Variable& a, const Variable& b);
+Variable var_div_f(const Variable& a, const Variable& b);
 
-Variable var_f2i(Variable a);
-Variable var_i2f(Variable a);
+Variable var_f2i(const Variable& a);
+Variable var_i2f(const Variable& a);
 
 #endif //DTC_VARMATH_H
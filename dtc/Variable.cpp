@@ -1,29 +1,9 @@
 #include "Variable.h"
 
 
-Variable::Variable(const Type &t, std::vector<std::byte> data) {
-    type = t;
-    if (type.deref_count > 0) {
-        // we assume the data has already been converted to a pointer into virtual ram
-        this->data = std::move(data);
-        return;
-    }
-    if (type.is_basic()) {
-        this->data = std::move(data);
-        return;
-    }
-    // we need to iterate for structs, because all sub-data should be Variables, not just bytes
-    // this allows sub-structs and pointers in those to be created properly
-    if (auto s = std::get_if<StructType>(&type.type)) {
-        size_t offset = 0;
-        for (auto &t: s->types) {
-            size_t size = t_sizeof(t);
-            std::vector<std::byte> subdata(data.begin() + offset, data.begin() + offset + size);
-            offset += size;
-            Variable v(t, subdata);
-            this->data.insert(this->data.end(), v.data.begin(), v.data.end());
-        }
-    }
+Variable::Variable(const Type &t, std::vector<std::byte> data) : type(t), data(std::move(data)) {
+    // nothing to convert: a pointer is assumed to already point into virtual ram, and a struct's
+    // bytes are already its fields' bytes back to back
 }
 
 Variable::Variable(Context& ctx, const Type &t, std::vector<std::byte> data) {
@@ -34,14 +14,58 @@ Variable::Variable(Context& ctx, const Type &t, std::vector<std::byte> data) {
             return;
         }
         if (auto s = std::get_if<StructType>(&type.type)) {
+            if (!t_has_pointers(type)) {
+                // nothing to move into the context
+                this->data = std::move(data);
+                return;
+            }
+            this->data.reserve(data.size());
             size_t offset = 0;
             for (auto &t: s->types) {
                 size_t size = t_sizeof(t);
                 std::vector<std::byte> subdata(data.begin() + offset, data.begin() + offset + size);
                 offset += size;
-                Variable v(ctx, t, subdata);
+                Variable v(ctx, t, std::move(subdata));
+                this->data.insert(this->data.end(), v.data.begin(), v.data.end());
+            }
+        } else if (type.is_slice()) {
+            uint64_t ptr = 0;
+            uint64_t count = 0;
+            for (size_t i = 0; i < 8; i++) {
+                ptr |= std::to_integer<uint64_t>(data[i]) << (i * 8);
+                count |= std::to_integer<uint64_t>(data[sizeof(void*) + i]) << (i * 8);
+            }
+            this->data = new_slice(reinterpret_cast<void*>(ptr), count, ctx, type).data;
+        } else if (auto a = std::get_if<ArrayType>(&type.type)) {
+            const Type& elem = a->elem();
+            if (!t_has_pointers(elem)) {
+                // nothing to move into the context, so the elements are copied in one go
+                this->data = std::move(data);
+                return;
+            }
+            size_t size = t_sizeof(elem);
+            this->data.reserve(size * a->count);
+            for (uint64_t i = 0; i < a->count; i++) {
+                std::vector<std::byte> subdata(data.begin() + i * size, data.begin() + (i + 1) * size);
+                Variable v(ctx, elem, std::move(subdata));
                 this->data.insert(this->data.end(), v.data.begin(), v.data.end());
             }
+        } else if (auto u = std::get_if<UnionType>(&type.type)) {
+            uint32_t tag = 0;
+            std::memcpy(&tag, data.data(), 4);
+            if (tag >= u->types.size()) {
+                throw std::runtime_error("union tag out of range");
+            }
+            // only the active member is converted, the bytes past it are cleared so every
+            // value with the same active member looks the same
+            const Type& member = u->types[tag];
+            size_t size = t_sizeof(member);
+            this->data = std::move(data);
+            std::fill(this->data.begin() + 4 + size, this->data.end(), std::byte(0));
+            if (t_has_pointers(member)) {
+                Variable v(ctx, member, std::vector<std::byte>(this->data.begin() + 4, this->data.begin() + 4 + size));
+                std::copy(v.data.begin(), v.data.end(), this->data.begin() + 4);
+            }
         }
         return;
     }
@@ -52,7 +76,7 @@ Variable::Variable(Context& ctx, const Type &t, std::vector<std::byte> data) {
     Type t2 = t;
     t2.deref_count--;
     Variable v = new_ptr(reinterpret_cast<void*>(ptr), ctx, t2);
-    this->data = v.data;
+    this->data = std::move(v.data);
 
 }
 
@@ -107,7 +131,7 @@ Variable::Variable(std::initializer_list<Variable> vars) {
 }
 
 
-std::byte* Variable::getdata(size_t i) {
+const std::byte* Variable::getdata(size_t i) const {
     // if not a struct type, just return the data
     // if a struct type, return the data of the ith element in struct
     // if i is out of bounds, throw error
@@ -121,10 +145,21 @@ std::byte* Variable::getdata(size_t i) {
         }
         return data.data() + offset;
     }
+    if (auto a = std::get_if<ArrayType>(&type.type)) {
+        if (i >= a->count) {
+            throw std::runtime_error("Index out of bounds");
+        }
+        return data.data() + i * t_sizeof(a->elem());
+    }
+    // a union's data is the whole value (tag first), its members are read through getsub
     return data.data();
 }
 
-Variable Variable::getsub(size_t i) {
+std::byte* Variable::getdata(size_t i) {
+    return const_cast<std::byte*>(static_cast<const Variable*>(this)->getdata(i));
+}
+
+Variable Variable::getsub(size_t i) const {
     if (auto s = std::get_if<StructType>(&type.type)) {
         if (i >= s->types.size()) {
             throw std::runtime_error("Index out of bounds");
@@ -135,10 +170,23 @@ Variable Variable::getsub(size_t i) {
         }
         return Variable{s->types[i], std::vector<std::byte>(data.begin() + offset, data.begin() + offset + t_sizeof(s->types[i]))};
     }
+    if (auto a = std::get_if<ArrayType>(&type.type)) {
+        if (i >= a->count) {
+            throw std::runtime_error("Index out of bounds");
+        }
+        size_t size = t_sizeof(a->elem());
+        return Variable{a->elem(), std::vector<std::byte>(data.begin() + i * size, data.begin() + (i + 1) * size)};
+    }
+    if (auto u = std::get_if<UnionType>(&type.type)) {
+        if (i >= u->types.size()) {
+            throw std::runtime_error("Index out of bounds");
+        }
+        return Variable{u->types[i], std::vector<std::byte>(data.begin() + 4, data.begin() + 4 + t_sizeof(u->types[i]))};
+    }
     return *this;
 }
 
-Variable Variable::getsub(Context& ctx, size_t i) {
+Variable Variable::getsub(Context& ctx, size_t i) const {
     if (auto s = std::get_if<StructType>(&type.type)) {
         if (i >= s->types.size()) {
             throw std::runtime_error("Index out of bounds");
@@ -149,9 +197,51 @@ Variable Variable::getsub(Context& ctx, size_t i) {
         }
         return Variable{s->types[i], std::vector<std::byte>(data.begin() + offset, data.begin() + offset + t_sizeof(s->types[i]))};
     }
+    if (auto a = std::get_if<ArrayType>(&type.type)) {
+        if (i >= a->count) {
+            throw std::runtime_error("Index out of bounds");
+        }
+        size_t size = t_sizeof(a->elem());
+        return Variable{a->elem(), std::vector<std::byte>(data.begin() + i * size, data.begin() + (i + 1) * size)};
+    }
+    if (auto u = std::get_if<UnionType>(&type.type)) {
+        if (i >= u->types.size()) {
+            throw std::runtime_error("Index out of bounds");
+        }
+        return Variable{u->types[i], std::vector<std::byte>(data.begin() + 4, data.begin() + 4 + t_sizeof(u->types[i]))};
+    }
     return *this;
 }
 
+uint64_t Context::append(const void *p, uint64_t size) {
+    uint64_t index = this->size();
+    resize(index + size);
+    if (size > 0) {
+        std::memcpy(data() + index, p, size);
+    }
+    return index;
+}
+
+uint64_t Context::intern(const void *p, uint64_t size) {
+    // FNV-1a
+    auto bytes = static_cast<const unsigned char*>(p);
+    uint64_t h = 0xcbf29ce484222325;
+    for (uint64_t i = 0; i < size; i++) {
+        h ^= bytes[i];
+        h *= 0x100000001b3;
+    }
+    auto range = strings.equal_range(h);
+    for (auto it = range.first; it != range.second; ++it) {
+        uint64_t off = it->second;
+        if (off + size <= this->size() && std::memcmp(data() + off, p, size) == 0) {
+            return off;
+        }
+    }
+    uint64_t index = append(p, size);
+    strings.emplace(h, index);
+    return index;
+}
+
 Variable new_i8(int8_t val) {
     Variable v;
     v.type = t_i8;
@@ -280,26 +370,20 @@ Variable new_struct(std::vector<Variable> vars) {
     types.reserve(vars.size());
     for (auto& v : vars) {
         data.insert(data.end(), v.data.begin(), v.data.end());
-        types.push_back(v.type);
+        types.push_back(std::move(v.type));
     }
-    return Variable{new_struct_type(types), data};
+    return Variable{new_struct_type(std::move(types)), std::move(data)};
 }
 
 Variable new_ptr(void *p, Context &ctx, const Type& t) {
     size_t arrlen = 1;
-    if (t.is_basic() && std::get<BasicType>(t.type).bytes == 1 && !std::get<BasicType>(t.type).sign) {
-        // we assume it's a null-terminated string
-        char* c = reinterpret_cast<char*>(p);
-        arrlen = 1;
-        while (*c != '\0') {
-            arrlen++;
-            c++;
-        }
+    bool is_string = t.deref_count == 0 && t.is_basic() && std::get<BasicType>(t.type).bytes == 1 && !std::get<BasicType>(t.type).sign;
+    if (is_string) {
+        // we assume it's a null-terminated string (strlen is vectorized by the c library)
+        arrlen = std::strlen(reinterpret_cast<const char*>(p)) + 1;
     }
     uint64_t size = t_sizeof(t)*arrlen;
-    size_t index = ctx.size();
-    ctx.resize(index + size);
-    std::memcpy(ctx.data() + index, p, size);
+    size_t index = is_string && ctx.intern_strings ? ctx.intern(p, size) : ctx.append(p, size);
     Variable v;
     v.type = t;
     v.data = std::vector<std::byte>(sizeof(void*));
@@ -311,6 +395,32 @@ Variable new_ptr(void *p, Context &ctx, const Type& t) {
 
     return v;
 }
+Variable new_slice(const void *p, uint64_t count, Context &ctx, const Type &t) {
+    auto& slice = std::get<SliceType>(t.type);
+    uint64_t size = t_sizeof(slice.elem()) * count;
+    uint64_t index;
+    if (slice.string && ctx.intern_strings) {
+        std::vector<std::byte> text(size + 1);
+        if (size > 0) {
+            std::memcpy(text.data(), p, size);
+        }
+        index = ctx.intern(text.data(), text.size());
+    } else if (slice.string) {
+        // the text plus a terminator, so the pointer still works as a C string
+        index = ctx.append(p, size);
+        ctx.push_back(std::byte(0));
+    } else {
+        index = ctx.append(p, size);
+    }
+    Variable v;
+    v.type = t;
+    v.data = std::vector<std::byte>(sizeof(void*) + 8);
+    for (size_t j = 0; j < 8; j++) {
+        v.data[j] = std::byte(index >> (j * 8));
+        v.data[sizeof(void*) + j] = std::byte(count >> (j * 8));
+    }
+    return v;
+}
 Variable new_ptr(void *p, Context &ctx, uint64_t size) {
     size_t index = ctx.size();
     ctx.resize(index + size);
@@ -4,7 +4,24 @@
 
 #include "Type.h"
 
-typedef std::vector<std::byte> Context; // virtual RAM for pointers
+#include <unordered_map>
+
+// virtual RAM for pointers
+struct Context : std::vector<std::byte> {
+    using std::vector<std::byte>::vector;
+
+    // with intern_strings set, new_ptr stores every distinct string once, and each pointer to the
+    // same text gets the same offset. strings are found by a hash of their contents (including the
+    // terminator) and compared against the copy already in the context
+    bool intern_strings = false;
+    std::unordered_multimap<uint64_t, uint64_t> strings{}; // content hash -> offset
+
+    // copies size bytes to the end, returns their offset
+    uint64_t append(const void* p, uint64_t size);
+
+    // the offset of an identical copy of these bytes if there is one, otherwise append(p, size)
+    uint64_t intern(const void* p, uint64_t size);
+};
 
 struct Variable {
     Type type{};
@@ -35,8 +52,9 @@ struct Variable {
     [[nodiscard]] bool is_basic() const;
 
     std::byte* getdata(size_t i=0);
-    Variable getsub(size_t i=0);
-    Variable getsub(Context& ctx, size_t i=0);
+    [[nodiscard]] const std::byte* getdata(size_t i=0) const;
+    [[nodiscard]] Variable getsub(size_t i=0) const;
+    [[nodiscard]] Variable getsub(Context& ctx, size_t i=0) const;
 };
 
 Variable new_i8(int8_t val);
@@ -56,6 +74,9 @@ Variable new_ptr(void* p, Context& ctx, uint64_t size);
 
 Variable new_varptr(Variable* p, Context& ctx);
 
+// copies count elements of the slice type t's element type into the context
+Variable new_slice(const void* p, uint64_t count, Context& ctx, const Type& t);
+
 Variable new_bool(bool val);
 
 Variable new_struct(std::vector<Variable> vars);
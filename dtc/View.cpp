@@ -0,0 +1,180 @@
+#include "View.h"
+
+static void build_layout(TypeLayout& l, const Type& t) {
+    l.type = t;
+    l.size = t_sizeof(t);
+    if (t.deref_count > 0) {
+        Type pointee = t.deref();
+        auto p = std::make_shared<TypeLayout>();
+        build_layout(*p, pointee);
+        l.pointee = std::move(p);
+        auto b = std::get_if<BasicType>(&pointee.type);
+        l.string = pointee.deref_count == 0 && b && b->bytes == 1 && !b->sign;
+    } else if (auto sl = std::get_if<SliceType>(&t.type)) {
+        auto p = std::make_shared<TypeLayout>();
+        build_layout(*p, sl->elem());
+        l.pointee = std::move(p);
+        l.slice = true;
+        l.string = sl->string;
+    } else if (auto a = std::get_if<ArrayType>(&t.type)) {
+        // the elements are inline, pointee only describes them
+        auto p = std::make_shared<TypeLayout>();
+        build_layout(*p, a->elem());
+        l.pointee = std::move(p);
+        l.count = a->count;
+    } else if (auto s = std::get_if<StructType>(&t.type)) {
+        uint64_t offset = 0;
+        l.fields.resize(s->types.size());
+        for (size_t i = 0; i < s->types.size(); i++) {
+            build_layout(l.fields[i], s->types[i]);
+            l.offsets.push_back(offset);
+            offset += l.fields[i].size;
+        }
+    }
+}
+
+TypeLayout::TypeLayout(const Type &t) {
+    if (t_has_union(t)) {
+        throw std::runtime_error("values with unions have no fixed layout to view");
+    }
+    build_layout(*this, t);
+    header = serialize_type(t);
+    pointers = t_pointer_offsets(t);
+}
+
+View View::field(size_t i) const {
+    if (layout->type.is_array() && layout->type.deref_count == 0) {
+        return at(i); // field paths index into arrays too
+    }
+    if (i >= layout->fields.size()) {
+        throw std::runtime_error("Index out of bounds");
+    }
+    return View{&layout->fields[i], data + layout->offsets[i], ctx};
+}
+
+View View::field(const FieldPath &path) const {
+    View v = *this;
+    for (uint64_t i : path) {
+        v = v.field(i);
+    }
+    return v;
+}
+
+View View::deref() const {
+    if (!layout->pointee || (layout->type.is_array() && layout->type.deref_count == 0)) {
+        throw std::runtime_error("view is not a pointer");
+    }
+    uint64_t ptr = deserialize_u64(data);
+    uint64_t size = layout->pointee->size;
+    if (layout->slice) {
+        uint64_t n = count();
+        if (size != 0 && n > ctx.size() / size) {
+            throw std::runtime_error("slice outside the context");
+        }
+        size = size * n + (layout->string ? 1 : 0);
+    }
+    if (ptr > ctx.size() || ctx.size() - ptr < size) {
+        throw std::runtime_error("pointer outside the context");
+    }
+    return View{layout->pointee.get(), ctx.data() + ptr, ctx};
+}
+
+uint64_t View::count() const {
+    if (layout->type.is_array() && layout->type.deref_count == 0) {
+        return layout->count;
+    }
+    if (!layout->slice) {
+        throw std::runtime_error("view is not a slice");
+    }
+    return deserialize_u64(data + sizeof(void*));
+}
+
+View View::at(size_t i) const {
+    if (i >= count()) {
+        throw std::runtime_error("Index out of bounds");
+    }
+    if (!layout->slice) {
+        return View{layout->pointee.get(), data + i * layout->pointee->size, ctx};
+    }
+    View first = deref();
+    first.data += i * first.layout->size;
+    return first;
+}
+
+const char *View::str() const {
+    if (!layout->string) {
+        throw std::runtime_error("view is not a string");
+    }
+    View target = deref();
+    if (layout->slice) {
+        // deref() already checked the terminator's byte is in the context
+        if (target.data[count()] != std::byte(0)) {
+            throw std::runtime_error("string is not terminated inside the context");
+        }
+        return reinterpret_cast<const char*>(target.data);
+    }
+    size_t left = ctx.size() - size_t(target.data - ctx.data());
+    if (std::memchr(target.data, 0, left) == nullptr) {
+        throw std::runtime_error("string is not terminated inside the context");
+    }
+    return reinterpret_cast<const char*>(target.data);
+}
+
+View open_view(ByteSpan frame, const TypeLayout &layout) {
+    FrameHeader h = read_frame_header(frame);
+    if (h.flags & FRAME_COMPACT_PTR) {
+        throw std::runtime_error("frames with compact pointers can't be viewed in place");
+    }
+    if ((h.flags & FRAME_FINGERPRINT) && h.fingerprint != layout.type.fingerprint()) {
+        throw std::runtime_error("record has a different type than the layout");
+    }
+    ByteSpan body = frame.subspan(h.header_size, h.body_size);
+    if (body.size() != layout.header.size() + layout.size ||
+        !std::equal(layout.header.begin(), layout.header.end(), body.begin())) {
+        throw std::runtime_error("record has a different type than the layout");
+    }
+    return View{&layout, body.data() + layout.header.size(), frame.subspan(h.header_size + h.body_size, h.ctx_size)};
+}
+
+void decode_frame_into(ByteSpan frame, const TypeLayout &layout, void *out, Context &arena) {
+    FrameHeader h = read_frame_header(frame);
+    const std::byte* body = frame.data() + h.header_size;
+    bool compact = h.flags & FRAME_COMPACT_PTR;
+    if (h.body_size != layout.header.size() + layout.size - (compact ? layout.pointers.size() * 4 : 0)) {
+        throw std::runtime_error("record has a different type than the layout");
+    }
+    if (h.flags & FRAME_FINGERPRINT) {
+        // the fingerprint covers the type header, so it doesn't have to be compared as well
+        if (h.fingerprint != layout.type.fingerprint()) {
+            throw std::runtime_error("record has a different type than the layout");
+        }
+    } else if (!std::equal(layout.header.begin(), layout.header.end(), body)) {
+        throw std::runtime_error("record has a different type than the layout");
+    }
+
+    arena.resize(h.ctx_size);
+    arena.strings.clear();
+    if (h.flags & FRAME_CHECKSUM) {
+        if (crc32c_copy(0, arena.data(), body + h.body_size, h.ctx_size) != h.ctx_crc ||
+            crc32c(0, body, h.body_size) != h.body_crc) {
+            throw std::runtime_error("frame checksum mismatch");
+        }
+    } else if (h.ctx_size > 0) {
+        std::memcpy(arena.data(), body + h.body_size, h.ctx_size);
+    }
+
+    auto* dst = static_cast<std::byte*>(out);
+    if (compact) {
+        widen_pointers(body + layout.header.size(), dst, layout.size, layout.pointers);
+    } else {
+        std::memcpy(dst, body + layout.header.size(), layout.size);
+    }
+    for (uint64_t off : layout.pointers) {
+        uint64_t ptr = deserialize_u64(dst + off);
+        if (ptr > arena.size()) {
+            throw std::runtime_error("pointer outside the context");
+        }
+        const std::byte* real = arena.data() + ptr;
+        std::memcpy(dst + off, &real, sizeof(void*));
+    }
+}
@@ -0,0 +1,83 @@
+#pragma once
+#ifndef DTC_VIEW_H
+#define DTC_VIEW_H
+
+#include <memory>
+#include "Serial.h"
+
+// read-only access to a serialized record without deserializing it.
+// a View is a typed position inside a record's body, fields and pointer targets are found with
+// offsets precomputed in a TypeLayout, and values are read straight out of the buffer,
+// so reading a field does no allocation and copies nothing but the value itself.
+// the buffer has to outlive every View into it. checksums are not verified here (see verify_frame)
+
+// the layout of a type, computed once and shared by every View of that type
+struct TypeLayout {
+    Type type{};
+    uint64_t size = 0;
+    std::vector<uint64_t> offsets{}; // of each struct field
+    std::vector<TypeLayout> fields{};
+    std::shared_ptr<const TypeLayout> pointee{}; // for pointers and slices, what they point at
+    bool slice = false;
+    uint64_t count = 0; // of an array, whose elements are laid out by pointee
+    bool string = false; // pointer to a null-terminated string, or a string slice
+    Bytes header{}; // the serialized type, only set on the root layout
+    std::vector<uint64_t> pointers{}; // t_pointer_offsets of the type, only set on the root layout
+
+    TypeLayout() = default;
+    // throws for a type with unions (t_has_union), they're serialized at a size that depends on the tags
+    explicit TypeLayout(const Type& t);
+};
+
+struct View {
+    const TypeLayout* layout = nullptr;
+    const std::byte* data = nullptr; // the value's bytes, inside the body
+    ByteSpan ctx{};
+
+    [[nodiscard]] View field(size_t i) const;
+    [[nodiscard]] View field(const FieldPath& path) const;
+
+    // follows a pointer into the context (for a slice, its first element)
+    [[nodiscard]] View deref() const;
+
+    // number of elements of a slice (stored in the record so it's O(1)) or of an array
+    [[nodiscard]] uint64_t count() const;
+
+    // element i of a slice or an array
+    [[nodiscard]] View at(size_t i) const;
+
+    // the characters of a string pointer or string slice, in the context
+    [[nodiscard]] const char* str() const;
+
+    template<typename T>
+    T get() const {
+        if (sizeof(T) != layout->size || layout->type.deref_count > 0) {
+            throw std::runtime_error("view type size mismatch");
+        }
+        T res;
+        std::memcpy(&res, data, sizeof(T));
+        return res;
+    }
+};
+
+// checks the record's type header against layout and returns a View of the whole value.
+// frames with compact pointers (FRAME_COMPACT_PTR) don't have the layout's offsets, so they can't be viewed
+View open_view(ByteSpan frame, const TypeLayout& layout);
+
+// decodes a frame of layout's type into out (layout.size bytes), with its pointers into arena.
+// the context is copied into arena, reusing its capacity, so once arena is big enough for the
+// records being decoded this doesn't allocate at all. decoding into the same arena again
+// invalidates the pointers of the value decoded before
+void decode_frame_into(ByteSpan frame, const TypeLayout& layout, void* out, Context& arena);
+
+// final_deserialize without the allocations: no copies of the input, no Variables, and the
+// caller owns both the value and the arena its pointers point into
+template<typename T>
+void final_deserialize_into(ByteSpan frame, const TypeLayout& layout, T& out, Context& arena) {
+    if (sizeof(T) != layout.size) {
+        throw std::runtime_error("primitive type size mismatch");
+    }
+    decode_frame_into(frame, layout, &out, arena);
+}
+
+#endif //DTC_VIEW_H
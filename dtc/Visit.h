@@ -0,0 +1,128 @@
+#pragma once
+#ifndef DTC_VISIT_H
+#define DTC_VISIT_H
+
+#include "Type.h"
+
+// the walk over types (and values of them) that the algorithms on types are built on.
+// a visitor is a struct with a member for each kind of type, a visit calls the one for t's kind
+// directly (no virtual calls, no std::visit), so the whole walk inlines into the caller.
+// members get the type and its alternative by reference and values as pointers into the caller's
+// bytes, nothing is copied on the way down.
+// a visit is one step: a member walks into the types inside by visiting them itself, so it can
+// stop early, skip parts, or do something before and after.
+//
+// type visitor members (all returning the same type):
+//   on_pointer(const Type& t)                  visit_type only, for any t with deref_count > 0
+//   on_basic(const Type& t, const BasicType& b)
+//   on_struct(const Type& t, const StructType& s)
+//   on_slice(const Type& t, const SliceType& s)
+//   on_array(const Type& t, const ArrayType& a)
+//   on_union(const Type& t, const UnionType& u)
+// value visitor members are the same with the value's bytes (Byte* data) added at the end.
+
+// calls v's member for the kind of t, whatever its deref_count
+template<typename V>
+decltype(auto) visit_kind(const Type& t, V&& v) {
+    switch (t.type.index()) {
+        case 0:
+            return v.on_basic(t, *std::get_if<BasicType>(&t.type));
+        case 1:
+            return v.on_struct(t, *std::get_if<StructType>(&t.type));
+        case 2:
+            return v.on_slice(t, *std::get_if<SliceType>(&t.type));
+        case 3:
+            return v.on_array(t, *std::get_if<ArrayType>(&t.type));
+        default:
+            return v.on_union(t, *std::get_if<UnionType>(&t.type));
+    }
+}
+
+// visit_kind, except that pointers go to on_pointer
+template<typename V>
+decltype(auto) visit_type(const Type& t, V&& v) {
+    if (t.deref_count > 0) {
+        return v.on_pointer(t);
+    }
+    return visit_kind(t, std::forward<V>(v));
+}
+
+// visit_type for the value of type t at data
+template<typename Byte, typename V>
+decltype(auto) visit_value(const Type& t, Byte* data, V&& v) {
+    if (t.deref_count > 0) {
+        return v.on_pointer(t, data);
+    }
+    switch (t.type.index()) {
+        case 0:
+            return v.on_basic(t, *std::get_if<BasicType>(&t.type), data);
+        case 1:
+            return v.on_struct(t, *std::get_if<StructType>(&t.type), data);
+        case 2:
+            return v.on_slice(t, *std::get_if<SliceType>(&t.type), data);
+        case 3:
+            return v.on_array(t, *std::get_if<ArrayType>(&t.type), data);
+        default:
+            return v.on_union(t, *std::get_if<UnionType>(&t.type), data);
+    }
+}
+
+// the active member of a union value (its first 4 bytes), throws if there's no such member
+inline uint32_t union_tag(const UnionType& u, const std::byte* data) {
+    uint32_t tag = 0;
+    for (int i = 0; i < 4; i++) {
+        tag |= std::to_integer<uint32_t>(data[i]) << (i * 8);
+    }
+    if (tag >= u.types.size()) {
+        throw std::runtime_error("union tag out of range");
+    }
+    return tag;
+}
+
+// calls fn(const Type& member, Byte* member_data) for each member of the value of type t at data:
+// a struct's fields, an array's elements, a union's active member (after the tag). pointers,
+// slices and basic values have none.
+// fn returns false to stop, and then this returns false too
+template<typename Byte, typename Fn>
+bool for_each_member(const Type& t, Byte* data, Fn&& fn) {
+    if (t.deref_count > 0) {
+        return true;
+    }
+    if (auto s = std::get_if<StructType>(&t.type)) {
+        for (auto& field : s->types) {
+            if (!fn(field, data)) {
+                return false;
+            }
+            data += t_sizeof(field);
+        }
+    } else if (auto a = std::get_if<ArrayType>(&t.type)) {
+        uint64_t size = t_sizeof(a->elem());
+        for (uint64_t i = 0; i < a->count; i++) {
+            if (!fn(a->elem(), data + i * size)) {
+                return false;
+            }
+        }
+    } else if (auto u = std::get_if<UnionType>(&t.type)) {
+        return fn(u->types[union_tag(*u, data)], data + 4);
+    }
+    return true;
+}
+
+// calls fn(const Type& slot, Byte* slot_data) for every pointer and slice in the value of type t
+// at data (in a union, only the active member's), in offset order. arrays without pointers in
+// them aren't walked.
+// fn returns false to stop, and then this returns false too
+template<typename Byte, typename Fn>
+bool for_each_pointer(const Type& t, Byte* data, Fn&& fn) {
+    if (t.deref_count > 0 || t.is_slice()) {
+        return fn(t, data);
+    }
+    if (auto a = std::get_if<ArrayType>(&t.type); a && !t_has_pointers(a->elem())) {
+        return true;
+    }
+    return for_each_member(t, data, [&](const Type& member, Byte* d) {
+        return for_each_pointer(member, d, fn);
+    });
+}
+
+#endif //DTC_VISIT_H